@@ -0,0 +1,130 @@
+
+#ifndef _DECAF_ARENA
+#define _DECAF_ARENA
+
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string>
+#include <vector>
+
+/// decafArena - per-compilation bump allocator.
+/// Owns every AST node, list cell and string made while parsing, so the
+/// whole tree is released by freeing a handful of chunks.  Nothing
+/// allocated here has its destructor run.
+class decafArena {
+	static const size_t CHUNK_SIZE = 64 * 1024;
+	std::vector<char *> chunks;
+	char *cur;
+	char *end;
+	size_t used;
+	size_t reserved;
+
+	char *new_chunk(size_t size) {
+		char *chunk = (char *)malloc(size);
+		if (chunk == NULL) { throw std::bad_alloc(); }
+		chunks.push_back(chunk);
+		reserved += size;
+		return chunk;
+	}
+public:
+	size_t nodes;	// AST nodes allocated, counted by decafAST::operator new
+
+	decafArena() : cur(NULL), end(NULL), used(0), reserved(0), nodes(0) {}
+	~decafArena() { reset(); }
+
+	void *allocate(size_t size, size_t align = alignof(std::max_align_t)) {
+		size_t pad = (align - ((size_t)cur & (align - 1))) & (align - 1);
+		if (cur == NULL || size + pad > (size_t)(end - cur)) {
+			if (size + align > CHUNK_SIZE / 4) {
+				// oversized requests get a chunk of their own so the
+				// current chunk keeps serving small allocations
+				char *big = new_chunk(size + align);
+				pad = (align - ((size_t)big & (align - 1))) & (align - 1);
+				used += size;
+				return big + pad;
+			}
+			cur = new_chunk(CHUNK_SIZE);
+			end = cur + CHUNK_SIZE;
+			pad = (align - ((size_t)cur & (align - 1))) & (align - 1);
+		}
+		char *p = cur + pad;
+		cur = p + size;
+		used += size;
+		return p;
+	}
+	/// save - copy a string into the arena, NUL terminated
+	const char *save(const char *s, size_t len) {
+		char *p = (char *)allocate(len + 1, 1);
+		memcpy(p, s, len);
+		p[len] = '\0';
+		return p;
+	}
+	const char *save(const std::string &s) { return save(s.data(), s.size()); }
+
+	/// reset - release everything at once
+	void reset() {
+		for (size_t i = 0; i < chunks.size(); i++) { free(chunks[i]); }
+		chunks.clear();
+		cur = end = NULL;
+		used = reserved = 0;
+		nodes = 0;
+	}
+	size_t bytes_used() const { return used; }
+	size_t bytes_reserved() const { return reserved; }
+	size_t num_chunks() const { return chunks.size(); }
+};
+
+extern thread_local decafArena ast_arena;
+
+/// arena_vector - contiguous sequence with N elements of inline storage
+/// that spills into ast_arena.  Free space is kept at both ends so that
+/// push_front is as cheap as push_back; elements must be trivially
+/// copyable since they are moved with memcpy and never destroyed.
+template <class T, unsigned N>
+class arena_vector {
+	T *first, *last;	// the elements
+	T *lo, *hi;		// the storage they sit in
+	T inline_buf[N];
+
+	void grow() {
+		size_t n = last - first;
+		size_t cap = 2 * (hi - lo);
+		T *buf = (T *)ast_arena.allocate(cap * sizeof(T), alignof(T));
+		// centre the elements so either end can take n/2 more pushes
+		T *dst = buf + (cap - n) / 2;
+		if (n > 0) { memcpy(dst, first, n * sizeof(T)); }
+		lo = buf;
+		hi = buf + cap;
+		first = dst;
+		last = dst + n;
+	}
+public:
+	typedef T *iterator;
+	typedef const T *const_iterator;
+
+	arena_vector() : lo(inline_buf), hi(inline_buf + N) { first = last = inline_buf + N / 2; }
+	arena_vector(const arena_vector &) = delete;
+	arena_vector &operator=(const arena_vector &) = delete;
+
+	void push_back(const T &e) {
+		if (last == hi) { grow(); }
+		*last++ = e;
+	}
+	void push_front(const T &e) {
+		if (first == lo) { grow(); }
+		*--first = e;
+	}
+	size_t size() const { return last - first; }
+	bool empty() const { return first == last; }
+	T &operator[](size_t i) { return first[i]; }
+	T &front() { return *first; }
+	T &back() { return last[-1]; }
+	iterator begin() { return first; }
+	iterator end() { return last; }
+	const_iterator begin() const { return first; }
+	const_iterator end() const { return last; }
+};
+
+#endif
@@ -0,0 +1,69 @@
+// decaf-embed: the compiler used as a library (decaf.h, libdecaf.a)
+//
+// Compiles each Decaf file given, optimizes the module at -O2 and prints
+// its IR to stdout; with --vm runs each program in the bytecode
+// interpreter instead.  Nothing here is decafcomp's own driver code.
+
+#include "decaf.h"
+#include "optimize.h"
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include "llvm/Support/raw_ostream.h"
+
+using namespace std;
+
+/// compile - parse, optimize and generate path, then print the module
+static bool compile(const char *path, string &error) {
+	decaf_parser parser;
+	if (!parser.source.open(path)) {
+		error = "could not read file";
+		return false;
+	}
+	llvm::LLVMContext context;
+	std::unique_ptr<llvm::Module> module = decaf_compile(parser, context, error);
+	if (!module || !decaf_optimize(*module, 2, "", error)) {
+		return false;
+	}
+	module->print(llvm::outs(), nullptr);
+	return true;
+}
+
+/// interpret - lower path to bytecode and run it, with its status in status
+static bool interpret(const char *path, int &status, string &error) {
+	decaf_parser parser;
+	if (!parser.source.open(path)) {
+		error = "could not read file";
+		return false;
+	}
+	bool ok = decaf_parse(parser) == 0 && parser.program != NULL;
+	if (!ok) {
+		error = parser.error.empty() ? "no program" : parser.error;
+	}
+	vm_program program;
+	if (ok) {
+		ast_opt_stats removed;
+		decaf_optimize_ast(parser, removed);
+		ok = decaf_lower(parser, program, error);
+	}
+	decaf_release(NULL);
+	return ok && vm_run(program, status, error);
+}
+
+int main(int argc, char **argv) {
+	bool vm = argc > 1 && strcmp(argv[1], "--vm") == 0;
+	if (argc < (vm ? 3 : 2)) {
+		fprintf(stderr, "usage: %s [--vm] file.decaf...\n", argv[0]);
+		return 1;
+	}
+	int failures = 0;
+	for (int i = vm ? 2 : 1; i < argc; i++) {
+		string error;
+		int status = 0;
+		if (!(vm ? interpret(argv[i], status, error) : compile(argv[i], error))) {
+			fprintf(stderr, "%s: %s\n", argv[i], error.c_str());
+			failures++;
+		}
+	}
+	return failures ? 1 : 0;
+}
@@ -1,18 +1,180 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "decaf-stdlib.h"
 
+/* Output is collected in a buffer per thread and written to stdout when
+   the buffer fills, at exit, before read_int when interactive, and by
+   decaf_flush.  It is also written after each newline when
+   DECAF_LINE_BUFFERED is set (to anything but 0), or, when it is not
+   set, when stdout is a terminal. */
 
-#include <stdio.h>
+#define OUT_SIZE (1 << 16)
+
+static _Thread_local struct {
+  char data[OUT_SIZE];
+  size_t len;
+  int ready;  /* line decided and the exit flush registered */
+  int line;   /* write out after each newline */
+} out;
+
+/* "00" to "99", for converting two digits at a time */
+static const char digit_pairs[] =
+  "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+  "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+  "8081828384858687888990919293949596979899";
+
+static void out_setup(void) {
+  const char *env = getenv("DECAF_LINE_BUFFERED");
+  out.line = env ? strcmp(env, "0") != 0 : isatty(STDOUT_FILENO);
+  out.ready = 1;
+  atexit(decaf_flush);
+}
+
+void decaf_flush(void) {
+  if (out.len > 0) {
+    fwrite(out.data, 1, out.len, stdout);
+    out.len = 0;
+  }
+  fflush(stdout);
+}
+
+static void out_write(const char *s, size_t n) {
+  if (!out.ready) {
+    out_setup();
+  }
+  if (out.len + n > OUT_SIZE) {
+    decaf_flush();
+    if (n > OUT_SIZE) {
+      fwrite(s, 1, n, stdout);
+      return;
+    }
+  }
+  memcpy(out.data + out.len, s, n);
+  out.len += n;
+  if (out.line && memchr(s, '\n', n) != NULL) {
+    decaf_flush();
+  }
+}
 
 void print_int(int x) {
-  printf("%d", x);
+  char digits[12];
+  char *end = digits + sizeof digits, *p = end;
+  unsigned u = x < 0 ? 0u - (unsigned)x : (unsigned)x;
+  while (u >= 100) {
+    unsigned pair = u % 100;
+    u /= 100;
+    p -= 2;
+    memcpy(p, digit_pairs + 2 * pair, 2);
+  }
+  if (u >= 10) {
+    p -= 2;
+    memcpy(p, digit_pairs + 2 * u, 2);
+  } else {
+    *--p = (char)('0' + u);
+  }
+  if (x < 0) {
+    *--p = '-';
+  }
+  out_write(p, end - p);
 }
 
 void print_string(const char *s) {
-  printf("%s", s);
+  out_write(s, strlen(s));
+}
+
+/* Input is scanned by hand rather than by scanf.  A regular file on
+   stdin is mapped whole and read from its current offset; anything else
+   (a pipe, a terminal) is read a block at a time.  Like scanf("%d"),
+   read_int skips whitespace, takes an optional sign and then digits, and
+   leaves the first character after them unread.  At end of input, or
+   when no digits follow, it returns 0 and consumes nothing past the
+   sign, so every later call returns 0 as well.  Out of range values wrap
+   around instead of being undefined. */
+
+#define IN_SIZE (1 << 16)
+
+static struct {
+  const char *next, *end;  /* input not yet scanned */
+  char *block;             /* read buffer when stdin is not mapped */
+  int ready;
+  int done;                /* read returned end of file or an error */
+} in;
+
+static void in_setup(void) {
+  struct stat st;
+  off_t at = lseek(STDIN_FILENO, 0, SEEK_CUR);
+  in.ready = 1;
+  if (at >= 0 && fstat(STDIN_FILENO, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > at) {
+    void *area = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, STDIN_FILENO, 0);
+    if (area != MAP_FAILED) {
+      madvise(area, st.st_size, MADV_SEQUENTIAL);
+      in.next = (const char *)area + at;
+      in.end = (const char *)area + st.st_size;
+      in.done = 1;
+      return;
+    }
+  }
+  in.block = malloc(IN_SIZE);
+  in.done = in.block == NULL;
+}
+
+/* the next character of input, EOF at the end */
+static int in_peek(void) {
+  if (in.next == in.end) {
+    ssize_t got;
+    if (in.done) {
+      return EOF;
+    }
+    do {
+      got = read(STDIN_FILENO, in.block, IN_SIZE);
+    } while (got < 0 && errno == EINTR);
+    if (got <= 0) {
+      in.done = 1;
+      return EOF;
+    }
+    in.next = in.block;
+    in.end = in.block + got;
+  }
+  return (unsigned char)*in.next;
 }
 
 int read_int() {
-  int i;
-  scanf("%d", &i);
-  return i;
+  unsigned value = 0;
+  int negative = 0;
+  int c;
+  if (!out.ready) {
+    out_setup();
+  }
+  /* show a prompt before waiting for the answer */
+  if (out.line) {
+    decaf_flush();
+  }
+  if (!in.ready) {
+    in_setup();
+  }
+  while ((c = in_peek()) == ' ' || (c >= '\t' && c <= '\r')) {
+    in.next++;
+  }
+  if (c == '-' || c == '+') {
+    negative = c == '-';
+    in.next++;
+    c = in_peek();
+  }
+  while ((unsigned)(c - '0') <= 9) {
+    value = value * 10 + (unsigned)(c - '0');
+    in.next++;
+    c = in_peek();
+  }
+  return (int)(negative ? 0u - value : value);
 }
 
+void decaf_bounds_error(int index, int size) {
+  decaf_flush();
+  fprintf(stderr, "array index %d out of bounds for size %d\n", index, size);
+  exit(1);
+}
@@ -0,0 +1,26 @@
+
+#ifndef _DECAF_STDLIB
+#define _DECAF_STDLIB
+
+/* The Decaf standard library, decaf-stdlib.c.  Linked into native
+   programs, and into decafcomp for --run and --vm. */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void print_int(int x);
+void print_string(const char *s);
+int read_int(void);
+
+/* write out what print_int and print_string have buffered */
+void decaf_flush(void);
+
+/* called by code compiled with --bounds-check on an index out of range */
+void decaf_bounds_error(int index, int size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
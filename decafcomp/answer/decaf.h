@@ -0,0 +1,102 @@
+
+#ifndef _DECAF_H
+#define _DECAF_H
+
+// The Decaf compiler as a library, libdecaf.a (see the makefile): parse
+// a program, optimize its tree, then generate an LLVM module for it or
+// lower it to bytecode for vm_run (vm.h).  What is done with a module
+// afterwards is header only: decaf_link_stdlib (stdlib-link.h),
+// decaf_optimize (optimize.h), decaf_emit (emit.h) and decaf_run (jit.h).
+// decaf-embed.cc is a small program using it.
+//
+// Every call works on its own decaf_parser and LLVMContext plus state
+// kept per thread, so threads can each compile a program at once.
+// Built with -DDECAF_NO_LLVM there is no code generation, only the VM.
+
+#include <memory>
+#include <string>
+#ifndef DECAF_NO_LLVM
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#endif
+#include "source.h"
+#include "vm.h"
+
+class decafAST;
+
+// flex's handle on one reentrant scanner (the same typedef flex emits)
+typedef void *yyscan_t;
+
+/// decaf_parser - one parse of one program: the input, the scanner
+/// reading it and the tree that came out.  The AST arena and the interner
+/// are per thread, so separate threads can each run a parse at once.
+struct decaf_parser {
+	source_buffer source;
+	yyscan_t scanner;
+	decafAST *program;
+	std::string error;	// the syntax error that stopped the parse
+	decaf_parser() : scanner(NULL), program(NULL) {}
+};
+
+/// ast_opt_stats - nodes the AST optimizer removed, by the rewrite that
+/// removed them
+struct ast_opt_stats {
+	int folded;		// constant operands folded into one constant
+	int simplified;		// identities such as x + 0 and true && x
+	int reused;		// repeats of an expression computed earlier in the block
+	ast_opt_stats() : folded(0), simplified(0), reused(0) {}
+	int total() { return folded + simplified + reused; }
+	void add(const ast_opt_stats &other) {
+		folded += other.folded;
+		simplified += other.simplified;
+		reused += other.reused;
+	}
+};
+
+/// front_end_stats - what --stats reports about the front end of one
+/// compilation, or the sum over several: the interner, the arena and
+/// the AST optimizer
+struct front_end_stats {
+	size_t lookups, hits, spellings, spelling_bytes;	// symbol_interner
+	size_t nodes, bytes_used, bytes_reserved, chunks;	// decafArena
+	ast_opt_stats ast;
+	front_end_stats() : lookups(0), hits(0), spellings(0), spelling_bytes(0), nodes(0), bytes_used(0), bytes_reserved(0), chunks(0) {}
+	void add(const front_end_stats &other) {
+		lookups += other.lookups;
+		hits += other.hits;
+		spellings += other.spellings;
+		spelling_bytes += other.spelling_bytes;
+		nodes += other.nodes;
+		bytes_used += other.bytes_used;
+		bytes_reserved += other.bytes_reserved;
+		chunks += other.chunks;
+		ast.add(other.ast);
+	}
+};
+
+// parse parser.source into parser.program; returns yyparse's result
+extern int decaf_parse(decaf_parser &parser);
+
+// fold, simplify and CSE the tree in parser.program in place, before
+// decaf_codegen or decaf_lower
+extern void decaf_optimize_ast(decaf_parser &parser, ast_opt_stats &stats);
+
+#ifndef DECAF_NO_LLVM
+// code generation alone, and parsing plus code generation (which also
+// releases the tree).  Both return NULL and set error on failure.
+extern std::unique_ptr<llvm::Module> decaf_codegen(decaf_parser &parser, llvm::LLVMContext &context, std::string &error, bool check_bounds = false, bool ssa = false);
+extern std::unique_ptr<llvm::Module> decaf_compile(decaf_parser &parser, llvm::LLVMContext &context, std::string &error,
+                                                   bool optimize_ast = true, bool check_bounds = false, bool ssa = false,
+                                                   front_end_stats *stats = NULL);
+#endif
+
+// lowering to bytecode for vm_run instead
+extern bool decaf_lower(decaf_parser &parser, vm_program &program, std::string &error);
+
+// release the AST arena and the interner of this thread once a
+// compilation is done with them, first adding what they held to stats
+// unless it is NULL.  decaf_compile does this itself; after
+// decaf_parse and decaf_codegen or decaf_lower it is the caller's job.
+extern void decaf_release(front_end_stats *stats);
+
+#endif
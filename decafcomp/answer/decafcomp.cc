@@ -5,6 +5,8 @@
 #include <iostream>
 #include <sstream>
 #include <map>
+#include <unordered_map>
+#include <climits>
 #include <algorithm>
 
 
@@ -14,43 +16,626 @@
 
 using namespace std;
 
-symbol_table_list symtbl;
-llvm::Value* returnValue;
-bool isAssign = false;
-llvm::Type* assignType;
+// each parsing thread builds its trees in its own arena and interner
+thread_local decafArena ast_arena;
+thread_local symbol_interner symbols;
 
-llvm::Value* access_symtbl(string ident) {
-    for (auto i : symtbl) {
-        auto find_ident = i.find(ident);
-        if (find_ident != i.end()) {
-            return find_ident->second;
-        }
-    }
-    return NULL;
+#ifndef DECAF_NO_LLVM
+// https://releases.llvm.org/3.6.0/docs/tutorial/LangImpl8.html
+// a stack slot at the top of the function, where mem2reg can promote it
+// and the frame never grows as the function runs
+static llvm::AllocaInst *CreateEntryBlockAlloca(llvm::Function *TheFunction, llvm::Type* VarType, const std::string &VarName) {
+	llvm::IRBuilder<> TmpB(&TheFunction->getEntryBlock(), TheFunction->getEntryBlock().begin());
+  	return TmpB.CreateAlloca(VarType, NULL, VarName.c_str());
+}
+
+// type of the value stored at a variable's address (alloca or global)
+llvm::Type* getStorageType(llvm::Value* ptr) {
+	if (llvm::AllocaInst *A = llvm::dyn_cast<llvm::AllocaInst>(ptr)) { return A->getAllocatedType(); }
+	if (llvm::GlobalVariable *G = llvm::dyn_cast<llvm::GlobalVariable>(ptr)) { return G->getValueType(); }
+	return ptr->getType()->getPointerElementType();
 }
+#endif
+
+/// decl_ref - what decafResolver bound a name to: a slot among the locals
+/// of the method (its parameters first), a global variable or array, or
+/// a method or extern, each by its index in decafContext
+enum decafDeclKind { DeclNone, DeclLocal, DeclGlobal, DeclArray, DeclMethod };
+struct decl_ref {
+	decafDeclKind kind;
+	int index;
+	decl_ref(decafDeclKind kind = DeclNone, int index = 0) : kind(kind), index(index) {}
+};
+
+/// decafResolver - the state Resolve() works in.  It runs over the tree
+/// once before Codegen(), numbering every declaration and binding every
+/// use of a name and every call to it, so Codegen() finds variables,
+/// globals and callees by index instead of by name.  Names that are not
+/// defined, or not what they are used as, calls with the wrong number of
+/// arguments and a break or continue outside a loop are reported here.
+class decafResolver {
+	// methods and externs share one global namespace that variables do
+	// not shadow, so calls resolve by the callee's symbol_id
+	vector<int> function_tbl;
+	vector<int> arity;	// parameters of each function, by index
+public:
+	scoped_symbol_table<decl_ref> names;
+	int locals;		// slots of the method being resolved
+	int globals;		// global variables and arrays
+	int functions;		// methods and externs
+	int loops;		// around the statement being resolved
+
+	decafResolver() : locals(0), globals(0), functions(0), loops(0) {}
+
+	decl_ref lookup(symbol_id sym) {
+		decl_ref ref = names.lookup(sym);
+		if (ref.kind == DeclNone) { throw runtime_error(symbols.name(sym) + " is not defined"); }
+		return ref;
+	}
+	/// variable - the local or global variable sym names
+	decl_ref variable(symbol_id sym) {
+		decl_ref ref = lookup(sym);
+		if (ref.kind != DeclLocal && ref.kind != DeclGlobal) { throw runtime_error(symbols.name(sym) + " is not a variable"); }
+		return ref;
+	}
+	/// array - the index among the globals of the array sym names
+	int array(symbol_id sym) {
+		decl_ref ref = lookup(sym);
+		if (ref.kind != DeclArray) { throw runtime_error(symbols.name(sym) + " is not an array"); }
+		return ref.index;
+	}
+	/// define_function - number the method or extern sym, which takes
+	/// nparams parameters
+	int define_function(symbol_id sym, int nparams) {
+		if (sym >= (symbol_id)function_tbl.size()) { function_tbl.resize(sym + 1, -1); }
+		function_tbl[sym] = functions;
+		arity.push_back(nparams);
+		names.insert(sym, decl_ref(DeclMethod, functions));
+		return functions++;
+	}
+	/// function - the index of the method or extern sym, called with
+	/// nargs arguments
+	int function(symbol_id sym, int nargs) {
+		int index = sym < (symbol_id)function_tbl.size() ? function_tbl[sym] : -1;
+		if (index < 0) { throw runtime_error(symbols.name(sym) + " is not a method"); }
+		if (nargs != arity[index]) { throw runtime_error("wrong number of arguments to " + symbols.name(sym)); }
+		return index;
+	}
+};
+
+#ifndef DECAF_NO_LLVM
+/// decafContext - the state code generation for one program works in:
+/// the module being built, the IR builder, the values of what
+/// decafResolver numbered and the pending return value.  Every Codegen()
+/// call receives it, so separate compilations, each on its own
+/// LLVMContext, never share anything.
+class decafContext {
+	// SSA construction (Braun et al., "Simple and Efficient Construction
+	// of Static Single Assignment Form").  A variable's value at the end
+	// of each block it was assigned or read in; phis made in blocks whose
+	// predecessors are not all known yet, completed when the block is
+	// sealed.  Handles follow a trivial phi when it is replaced.
+	llvm::DenseMap<std::pair<llvm::Value*, llvm::BasicBlock*>, llvm::WeakTrackingVH> defs;
+	llvm::DenseMap<llvm::BasicBlock*, vector<std::pair<llvm::Value*, llvm::PHINode*> > > incomplete;
+	llvm::SmallPtrSet<llvm::BasicBlock*, 32> sealed;
+	vector<llvm::AllocaInst*> ssa_vars;
+	// trivial phis and what replaced them.  Codegen may still hold one
+	// it read earlier (a call argument, an operand), so they stay in
+	// their blocks until finish_function() erases them.
+	vector<std::pair<llvm::PHINode*, llvm::WeakTrackingVH> > trivial;
+	llvm::SmallPtrSet<llvm::PHINode*, 32> replaced;
+
+	llvm::Value *read_variable(llvm::Value *var, llvm::BasicBlock *BB) {
+		auto found = defs.find(std::make_pair(var, BB));
+		if (found != defs.end()) { return found->second; }
+		llvm::Type *type = getStorageType(var);
+		llvm::Value *val;
+		if (!sealed.count(BB)) {
+			llvm::PHINode *phi = new_phi(type, var, BB);
+			incomplete[BB].push_back(std::make_pair(var, phi));
+			val = phi;
+		} else if (llvm::BasicBlock *pred = BB->getSinglePredecessor()) {
+			val = read_variable(var, pred);
+		} else {
+			// a block with no predecessors gets undef this way too
+			llvm::PHINode *phi = new_phi(type, var, BB);
+			defs[std::make_pair(var, BB)] = phi;
+			val = add_phi_operands(var, phi);
+		}
+		defs[std::make_pair(var, BB)] = val;
+		return val;
+	}
+	llvm::PHINode *new_phi(llvm::Type *type, llvm::Value *var, llvm::BasicBlock *BB) {
+		if (BB->empty()) { return llvm::PHINode::Create(type, 0, var->getName(), BB); }
+		return llvm::PHINode::Create(type, 0, var->getName(), &BB->front());
+	}
+	llvm::Value *add_phi_operands(llvm::Value *var, llvm::PHINode *phi) {
+		for (llvm::BasicBlock *pred : llvm::predecessors(phi->getParent())) {
+			phi->addIncoming(read_variable(var, pred), pred);
+		}
+		return remove_trivial_phi(phi);
+	}
+	// a phi of only itself and one other value is that value
+	llvm::Value *remove_trivial_phi(llvm::PHINode *phi) {
+		if (replaced.count(phi)) { return phi; }
+		llvm::Value *same = NULL;
+		for (llvm::Value *op : phi->incoming_values()) {
+			if (op == same || op == phi) { continue; }
+			if (same != NULL) { return phi; }
+			same = op;
+		}
+		if (same == NULL) { same = llvm::UndefValue::get(phi->getType()); }
+		vector<llvm::PHINode*> users;
+		for (llvm::User *user : phi->users()) {
+			if (user != phi && llvm::isa<llvm::PHINode>(user)) { users.push_back(llvm::cast<llvm::PHINode>(user)); }
+		}
+		phi->replaceAllUsesWith(same);
+		replaced.insert(phi);
+		trivial.push_back(std::make_pair(phi, llvm::WeakTrackingVH(same)));
+		// phis that used it may be trivial now
+		for (llvm::PHINode *other : users) { remove_trivial_phi(other); }
+		return same;
+	}
+public:
+	llvm::LLVMContext &TheContext;
+	llvm::Module *TheModule;
+	llvm::IRBuilder<> Builder;
+	// what decafResolver numbered: the variables of the method being
+	// generated, the globals and the functions
+	vector<llvm::Value*> locals;
+	vector<llvm::GlobalVariable*> globals;
+	vector<llvm::Function*> functions;
+	// where continue and break go in the loops being generated,
+	// innermost last
+	vector<std::pair<llvm::BasicBlock*, llvm::BasicBlock*> > loops;
+	llvm::Value* returnValue;
+	bool checkBounds;	// test array indexes against the array's size
+	bool ssa;		// keep scalar locals in SSA values instead of allocas
+	// the stack slots of the blocks being generated, innermost last, and
+	// those of blocks already finished, free to be used again
+	vector<vector<llvm::AllocaInst*> > block_slots;
+	vector<llvm::AllocaInst*> free_slots;
+
+	decafContext(llvm::LLVMContext &context, llvm::Module *module)
+		: TheContext(context), TheModule(module), Builder(context), returnValue(NULL), checkBounds(false), ssa(false) {}
+	~decafContext() {
+		for (llvm::AllocaInst *var : ssa_vars) { var->deleteValue(); }
+	}
+
+	/// variable - the alloca (or SSA variable) or global ref is bound to
+	llvm::Value *variable(decl_ref ref) {
+		if (ref.kind == DeclLocal) { return locals[ref.index]; }
+		return globals[ref.index];
+	}
+	/// local - a stack slot for a variable of type declared here.  Inside a
+	/// block it may be the slot of a variable whose block has ended, and
+	/// it is live (llvm.lifetime) from here to the end of the block.
+	/// With ssa it is an alloca in no function, which only names the
+	/// variable for load() and store().
+	llvm::AllocaInst *local(llvm::Type *type, llvm::StringRef name) {
+		if (ssa) {
+			ssa_vars.push_back(new llvm::AllocaInst(type, 0, NULL, TheModule->getDataLayout().getPrefTypeAlign(type), name));
+			return ssa_vars.back();
+		}
+		if (block_slots.empty()) {
+			return CreateEntryBlockAlloca(Builder.GetInsertBlock()->getParent(), type, name.str());
+		}
+		llvm::AllocaInst *slot = NULL;
+		for (auto i = free_slots.begin(); i != free_slots.end(); i++) {
+			if ((*i)->getAllocatedType() == type) {
+				slot = *i;
+				free_slots.erase(i);
+				break;
+			}
+		}
+		if (slot == NULL) { slot = CreateEntryBlockAlloca(Builder.GetInsertBlock()->getParent(), type, name.str()); }
+		Builder.CreateLifetimeStart(slot);
+		block_slots.back().push_back(slot);
+		return slot;
+	}
+	/// is_ssa - whether var, from variable(), is an SSA variable
+	bool is_ssa(llvm::Value *var) {
+		llvm::AllocaInst *slot = llvm::dyn_cast<llvm::AllocaInst>(var);
+		return slot != NULL && slot->getParent() == NULL;
+	}
+	/// load - the value of variable var here
+	llvm::Value *load(llvm::Value *var, const llvm::Twine &name) {
+		if (is_ssa(var)) { return read_variable(var, Builder.GetInsertBlock()); }
+		return Builder.CreateLoad(getStorageType(var), var, name);
+	}
+	/// store - assign val to variable var
+	void store(llvm::Value *val, llvm::Value *var) {
+		if (is_ssa(var)) {
+			defs[std::make_pair(var, Builder.GetInsertBlock())] = val;
+		} else {
+			Builder.CreateStore(val, var);
+		}
+	}
+	/// seal - BB has all the predecessors it will get, so phis for the
+	/// variables read in it so far can be completed.  Code generation
+	/// seals each block right after the last branch to it is made.
+	void seal(llvm::BasicBlock *BB) {
+		if (!ssa) { return; }
+		sealed.insert(BB);
+		auto found = incomplete.find(BB);
+		if (found == incomplete.end()) { return; }
+		vector<std::pair<llvm::Value*, llvm::PHINode*> > phis;
+		phis.swap(found->second);
+		incomplete.erase(found);
+		for (auto &pending : phis) { add_phi_operands(pending.first, pending.second); }
+	}
+	/// finish_function - replace the trivial phis found while generating
+	/// the function once more, for the uses made of them since, and erase
+	/// them.  A handle follows its replacement if that was trivial too.
+	void finish_function() {
+		for (auto &removed : trivial) {
+			llvm::Value *same = removed.second;
+			if (same == NULL || same == removed.first) { same = llvm::UndefValue::get(removed.first->getType()); }
+			removed.first->replaceAllUsesWith(same);
+		}
+		for (auto &removed : trivial) { removed.first->eraseFromParent(); }
+		trivial.clear();
+		replaced.clear();
+	}
+	/// start_function - forget the variables, SSA state and free slots of
+	/// the last one; the new one has nlocals variables
+	void start_function(int nlocals) {
+		locals.assign(nlocals, NULL);
+		free_slots.clear();
+		defs.clear();
+		incomplete.clear();
+		sealed.clear();
+	}
+	/// element - the address of element index of the array globals[array],
+	/// and the element type.  With checkBounds, an index that is not a
+	/// constant in range is tested first and decaf_bounds_error called if
+	/// it is out.
+	llvm::Value *element(int array_index, llvm::Value *index, llvm::Type *&type) {
+		llvm::GlobalVariable *array = globals[array_index];
+		if (!index->getType()->isIntegerTy(32)) { throw runtime_error("array index should be IntType"); }
+		llvm::ArrayType *array_type = llvm::cast<llvm::ArrayType>(array->getValueType());
+		type = array_type->getElementType();
+		uint64_t size = array_type->getNumElements();
+		llvm::ConstantInt *known = llvm::dyn_cast<llvm::ConstantInt>(index);
+		if (checkBounds && (known == NULL || known->getZExtValue() >= size)) {
+			llvm::Function *func = Builder.GetInsertBlock()->getParent();
+			llvm::BasicBlock *OutBB = llvm::BasicBlock::Create(TheContext, "outofbounds", func);
+			llvm::BasicBlock *InBB = llvm::BasicBlock::Create(TheContext, "inbounds", func);
+			// unsigned, so negative indexes are out too; the weights mark
+			// the failure as cold, which IRCE needs to split loops
+			llvm::Value *in = Builder.CreateICmpULT(index, Builder.getInt32(size), "inrange");
+			Builder.CreateCondBr(in, InBB, OutBB, llvm::MDBuilder(TheContext).createBranchWeights(1 << 20, 1));
+			seal(OutBB);
+			seal(InBB);
+			Builder.SetInsertPoint(OutBB);
+			Builder.CreateCall(bounds_error(), { index, Builder.getInt32(size) });
+			Builder.CreateUnreachable();
+			Builder.SetInsertPoint(InBB);
+		}
+		return Builder.CreateInBoundsGEP(array_type, array, { Builder.getInt32(0), index }, "arrayindex");
+	}
+	// void decaf_bounds_error(int index, int size), in decaf-stdlib.c
+	llvm::Function *bounds_error() {
+		llvm::Function *func = TheModule->getFunction("decaf_bounds_error");
+		if (func == NULL) {
+			llvm::FunctionType *type = llvm::FunctionType::get(Builder.getVoidTy(), { Builder.getInt32Ty(), Builder.getInt32Ty() }, false);
+			func = llvm::Function::Create(type, llvm::Function::ExternalLinkage, "decaf_bounds_error", TheModule);
+			func->setDoesNotReturn();
+			func->addFnAttr(llvm::Attribute::Cold);
+		}
+		return func;
+	}
+	/// terminated - whether the block being generated already ends in a
+	/// return or branch, so code added now could never run
+	bool terminated() {
+		llvm::BasicBlock *BB = Builder.GetInsertBlock();
+		return BB != NULL && BB->getTerminator() != NULL;
+	}
+	/// branch - jump to BB, unless control never reaches this point
+	void branch(llvm::BasicBlock *BB) {
+		if (!terminated()) { Builder.CreateBr(BB); }
+	}
+	/// return_default - return what a method gives back when it has no
+	/// value to return: nothing, 0 or true
+	void return_default() {
+		llvm::Type *type = Builder.GetInsertBlock()->getParent()->getReturnType();
+		if (type->isVoidTy()) {
+			Builder.CreateRetVoid();
+		} else {
+			Builder.CreateRet(type->isIntegerTy(32) ? Builder.getInt32(0) : Builder.getInt1(1));
+		}
+	}
+	void open_block() { block_slots.push_back(vector<llvm::AllocaInst*>()); }
+	// the block's variables are dead and their slots free
+	void close_block() {
+		bool ends = !terminated();
+		for (llvm::AllocaInst *slot : block_slots.back()) {
+			if (ends) { Builder.CreateLifetimeEnd(slot); }
+			free_slots.push_back(slot);
+		}
+		block_slots.pop_back();
+	}
+	llvm::Type* getType(decafType type) {
+		switch (type) {
+		case TypeString: return Builder.getInt8PtrTy();
+		case TypeInt: return Builder.getInt32Ty();
+		case TypeVoid: return Builder.getVoidTy();
+		case TypeBool: return Builder.getInt1Ty();
+		default: return NULL;
+		}
+	}
+};
+#endif
 
 
-llvm::Type* getType(string type) {
-	if (type == "StringType") { return Builder.getInt8PtrTy(); }
-	else if (type == "IntType") { return Builder.getInt32Ty(); }
-	else if (type == "VoidType") { return Builder.getVoidTy(); }
-	else if (type == "BoolType") { return Builder.getInt1Ty(); }
-	return NULL;
+// printable names for the tags in default-defs.h, for str() and errors
+static const char *typeNames[] = { "None", "IntType", "BoolType", "VoidType", "StringType" };
+static const char *constNames[] = { "NumberExpr", "BoolExpr", "StringConstant" };
+static const char *opNames[] = {
+	"Mult", "Div", "Mod", "Plus", "Minus", "Leftshift", "Rightshift",
+	"Eq", "Neq", "Geq", "Leq", "Gt", "Lt", "And", "Or", "Not", "UnaryMinus"
+};
+
+#ifndef DECAF_NO_LLVM
+/// expect_operand - check an operand of op in the LLVM path, as
+/// vmLowering::expect does in the VM's.  The verifier would reject most
+/// mismatches, but the IRBuilder folds constant operands (true + 1)
+/// before it can see them.
+static void expect_operand(llvm::Value *value, decafType wanted, decafOp op) {
+	llvm::Type *type = value->getType();
+	decafType found = type->isIntegerTy(1) ? TypeBool : type->isIntegerTy(32) ? TypeInt : type->isVoidTy() ? TypeVoid : TypeString;
+	if (found != wanted) { throw runtime_error(string("operand of ") + opNames[op] + " should be " + typeNames[wanted] + ", not " + typeNames[found]); }
 }
+#endif
 
-// https://releases.llvm.org/3.6.0/docs/tutorial/LangImpl8.html
-static llvm::AllocaInst *CreateEntryBlockAlloca(llvm::Function *TheFunction, llvm::Type* VarType, const std::string &VarName) {
-	llvm::IRBuilder<> TmpB(&TheFunction->getEntryBlock(), TheFunction->getEntryBlock().begin());
-  	return TmpB.CreateAlloca(VarType, NULL, VarName.c_str());
+/// vm_ref - what a name stands for in bytecode: a register of the current
+/// method, a global, an array, a method, or one of the stdlib functions
+/// the VM has built in
+enum decafVmRef { RefNone, RefLocal, RefGlobal, RefArray, RefMethod, RefExtern, RefPrintInt, RefPrintString, RefReadInt };
+struct vm_ref {
+	decafVmRef kind;
+	int index;
+	decafType type;		// of the variable, or what the method returns
+	vm_ref(decafVmRef kind = RefNone, int index = 0, decafType type = TypeNone) : kind(kind), index(index), type(type) {}
+};
+
+/// vm_loop - jumps out of the innermost loop still waiting for a target
+struct vm_loop {
+	vector<int> breaks;
+	vector<int> continues;
+};
+
+/// vmLowering - the state lowering one program to bytecode works in, the
+/// counterpart of decafContext for Lower().  Registers are handed out
+/// like a stack: locals stay allocated until their block ends and the
+/// temporaries of a statement are freed when the statement is done.
+class vmLowering {
+public:
+	vm_program &program;
+	// what decafResolver numbered, as in decafContext: the variables of
+	// the method being lowered, the globals and the functions
+	vector<vm_ref> slots;
+	vector<vm_ref> globals;
+	vector<vm_ref> functions;
+	vector<vm_loop> loops;
+	decafType returnType;	// of the method being lowered
+	decafType type;		// of the expression lowered last
+	int locals;		// registers below this hold variables
+	int next;		// first free register
+	int nregs;		// frame size of the method being lowered
+	int labelled;		// the latest instruction a jump goes to
+
+	vmLowering(vm_program &program) : program(program), returnType(TypeVoid), type(TypeNone), locals(0), next(0), nregs(0), labelled(-1) {}
+
+	/// variable - the register or global ref is bound to
+	vm_ref variable(decl_ref ref) {
+		if (ref.kind == DeclLocal) { return slots[ref.index]; }
+		return globals[ref.index];
+	}
+	int temp() {
+		if (++next > nregs) { nregs = next; }
+		return next - 1;
+	}
+	int emit(int32_t op, int32_t a = 0, int32_t b = 0, int32_t c = 0) { return program.emit(op, a, b, c); }
+	int here() { return program.code.size(); }
+	// here(), as the target of a jump
+	int label() { return labelled = here(); }
+	// the verifier rejects these in the LLVM path; of names the operator
+	// when what is one of its operands
+	void expect(decafType wanted, const char *what, const char *of = NULL) {
+		if (type == wanted) { return; }
+		throw runtime_error(string(what) + (of ? string(" of ") + of : "") + " should be " + typeNames[wanted] + ", not " + typeNames[type]);
+	}
+	// point the jump at instruction at to target, a label()
+	void patch(int at, int target) {
+		vm_insn &insn = program.code[at];
+		if (insn.op == VmJump) { insn.a = target; }
+		else if (insn.op == VmJumpIfZero || insn.op == VmJumpIfNotZero) { insn.b = target; }
+		else { insn.c = target; }
+	}
+	void patch(const vector<int> &jumps, int target) {
+		for (int at : jumps) { patch(at, target); }
+	}
+	// the last instruction, if it computed temporary reg and nothing
+	// jumps past it, so it can be folded into whatever uses reg
+	vm_insn *computed(int reg) {
+		if (reg < locals || reg != next - 1 || labelled == here() || program.code.empty()) { return NULL; }
+		vm_insn *last = &program.code.back();
+		return last->a == reg && vm_defines(last->op) ? last : NULL;
+	}
+	/// move - copy register from into register to, by having the
+	/// instruction that computed from write to directly when it can
+	void move(int to, int from) {
+		if (from == to) { return; }
+		if (vm_insn *last = computed(from)) {
+			last->a = to;
+			return;
+		}
+		emit(VmMove, to, from);
+	}
+	/// constant - whether reg was just loaded with a constant; if so the
+	/// load is dropped and value is the constant, to be used immediately
+	bool constant(int reg, int32_t &value) {
+		vm_insn *last = computed(reg);
+		if (last == NULL || last->op != VmConst) { return false; }
+		value = last->b;
+		program.code.pop_back();
+		next--;
+		return true;
+	}
+	/// jump_unless - a jump, to be patched, taken when cond is false.  A
+	/// comparison that just computed cond becomes the jump itself.
+	int jump_unless(int cond) {
+		// the opposite test of each comparison, VmEq to VmGe
+		static const decafVmOp negated[] = { VmJumpIfNe, VmJumpIfEq, VmJumpIfGe, VmJumpIfGt, VmJumpIfLe, VmJumpIfLt };
+		vm_insn *last = computed(cond);
+		if (last != NULL && last->op >= VmEq && last->op <= VmGe) {
+			*last = vm_insn { negated[last->op - VmEq], last->b, last->c, 0 };
+			return here() - 1;
+		}
+		return emit(VmJumpIfZero, cond);
+	}
+};
+
+
+class ConstantAST;
+class SharedExprAST;
+
+/// ast_name - what a name stands for, as far as the AST optimizer needs
+/// to know to type check an operand before dropping it
+enum decafNameKind { NameNone, NameLocal, NameGlobal, NameArray, NameMethod };
+struct ast_name {
+	decafNameKind kind;
+	decafType type;		// of the variable, or what the method returns
+	ast_name(decafNameKind kind = NameNone, decafType type = TypeNone) : kind(kind), type(type) {}
+};
+
+/// ast_value - what a value number stands for: an operator (a decafOp)
+/// applied to the value numbers a and b, a constant of kind a with value
+/// b, a variable a, or element b of array a.  Equal expressions get equal
+/// keys without ever being printed or walked again.
+enum decafValueTag { ValueConstant = OpUnaryMinus + 1, ValueVariable, ValueArrayLoc };
+struct ast_value {
+	int tag, a, b;
+	bool operator==(const ast_value &other) const { return tag == other.tag && a == other.a && b == other.b; }
+};
+struct ast_value_hash {
+	size_t operator()(const ast_value &v) const {
+		return ((size_t)(uint32_t)v.tag * 0x9e3779b1u ^ (size_t)(uint32_t)v.a) * 0x85ebca6bu ^ (size_t)(uint32_t)v.b;
+	}
+};
+
+/// ast_available - an expression computed earlier in the straight-line
+/// code being optimized, still holding the same value
+struct ast_available {
+	SharedExprAST *shared;
+	vector<symbol_id> reads;	// the variables and arrays it read
+};
+
+/// astOptimizer - the state Optimize() works in: folding constant
+/// operands, applying identities and reusing expressions computed earlier
+/// in the same basic block.  Optimize() returns the node to use in place
+/// of the one it was called on.  An operand is only ever dropped when it
+/// has no calls and its type checks, so a program with a semantic error
+/// still has it when it reaches Codegen() or Lower().
+class astOptimizer {
+public:
+	ast_opt_stats &stats;
+	scoped_symbol_table<ast_name> names;
+	unordered_map<ast_value, int, ast_value_hash> numbers;	// value numbers handed out
+	unordered_map<int, ast_available> avail;	// by value number
+	// the value numbers in avail that read each variable or array, and
+	// those that read any global or array, so an assignment or a call
+	// only visits what it makes out of date
+	unordered_map<symbol_id, vector<int> > readers;
+	vector<int> global_readers;
+	vector<symbol_id> reads;	// by the expressions optimized so far
+	int number;		// value number of the expression optimized last
+	int opaque;		// the last fresh() value number
+	int calls;		// method calls optimized so far
+	int traps;		// divisions optimized so far that may trap
+	int conditional;	// > 0 inside the right operand of && or ||
+	int nodes;		// nodes optimized so far
+	decafType type;		// of the expression optimized last, TypeNone if it does not check
+
+	astOptimizer(ast_opt_stats &stats) : stats(stats), number(0), opaque(0), calls(0), traps(0), conditional(0), nodes(0), type(TypeNone) {}
+
+	// optimize expression node and reuse an earlier copy if there is one
+	decafAST *expr(decafAST *node);
+	// nodes optimized and not eliminated; the difference across an
+	// expr() call is the size of the expression it returned
+	int live() { return nodes - stats.total(); }
+	// the value number of tag applied to a and b
+	int value_number(int tag, int a, int b = 0) {
+		auto added = numbers.insert(std::make_pair(ast_value{tag, a, b}, (int)numbers.size()));
+		return added.first->second;
+	}
+	// a value number equal to no other, for calls and anything not shared;
+	// these count down from -1 and value_number's up from 0
+	int fresh() { return --opaque; }
+	// past a branch or a join nothing is known to be available
+	void forget() {
+		if (!avail.empty()) {
+			avail.clear();
+			readers.clear();
+			global_readers.clear();
+		}
+	}
+	// sym is assigned, so expressions that read it are out of date.  The
+	// lists may name entries already gone, which erase skips.
+	void kill(symbol_id sym) {
+		auto found = readers.find(sym);
+		if (found == readers.end()) { return; }
+		for (int value : found->second) { avail.erase(value); }
+		readers.erase(found);
+	}
+	// a method call may assign any global or array
+	void kill_globals() {
+		for (int value : global_readers) { avail.erase(value); }
+		global_readers.clear();
+	}
+};
+
+
+// copy a string into ast_arena so it lives as long as the tree
+llvm::StringRef arena_str(llvm::StringRef s) {
+	return llvm::StringRef(ast_arena.save(s.data(), s.size()), s.size());
 }
 
+// the spelling of an interned identifier or literal
+llvm::StringRef symbol_text(symbol_id sym) {
+	return llvm::StringRef(symbols.text(sym), symbols.length(sym));
+}
 
 /// decafAST - Base class for all abstract syntax tree nodes.
+/// Nodes are carved out of ast_arena and freed together with it,
+/// so deleting a node is a no-op and destructors never recurse.
 class decafAST {
 public:
   virtual ~decafAST() {}
+  static void *operator new(size_t size) { ast_arena.nodes++; return ast_arena.allocate(size); }
+  static void operator delete(void *) {}
   virtual string str() { return string(""); }
-  virtual llvm::Value *Codegen() = 0;
+#ifndef DECAF_NO_LLVM
+  virtual llvm::Value *Codegen(decafContext &ctx) = 0;
+  // generate as the condition of a branch to TrueBB or FalseBB; returns
+  // the i1 branched on, or NULL if the branches needed no value
+  virtual llvm::Value *CondCodegen(decafContext &ctx, llvm::BasicBlock *TrueBB, llvm::BasicBlock *FalseBB) {
+    llvm::Value *cond = Codegen(ctx);
+    ctx.Builder.CreateCondBr(cond, TrueBB, FalseBB);
+    return cond;
+  }
+#endif
+  // lower to bytecode; expressions return the register holding their value
+  virtual int Lower(vmLowering &vm) = 0;
+  // rewrite for astOptimizer; returns the node to use in place of this
+  virtual decafAST *Optimize(astOptimizer &opt) { return this; }
+  // bind the names in this node for decafResolver, before Codegen()
+  virtual void Resolve(decafResolver &res) {}
+  // this node if it is a ConstantAST, else NULL (the tree has no RTTI)
+  virtual ConstantAST *constant() { return NULL; }
+  // whether astOptimizer may reuse the value of this expression
+  virtual bool shareable() { return false; }
 };
 
 string getString(decafAST *d) {
@@ -97,10 +682,13 @@ int strtoint(string s){
 	return result;
 }
 
-template <class T>
-string commaList(list<T> vec) {
+// children of a decafStmtList, stored contiguously
+typedef arena_vector<decafAST *, 4> decafList;
+
+template <class L>
+string commaList(const L &vec) {
     string s("");
-    for (typename list<T>::iterator i = vec.begin(); i != vec.end(); i++) { 
+    for (auto i = vec.begin(); i != vec.end(); i++) { 
         s = s + (s.empty() ? string("") : string(",")) + (*i)->str(); 
     }   
     if (s.empty()) {
@@ -109,42 +697,87 @@ string commaList(list<T> vec) {
     return s;
 }
 
-template <class T>
-llvm::Value *listCodegen(list<T> vec) {
+#ifndef DECAF_NO_LLVM
+template <class L>
+llvm::Value *listCodegen(decafContext &ctx, const L &vec) {
 	llvm::Value *val = NULL;
-	for (typename list<T>::iterator i = vec.begin(); i != vec.end(); i++) { 
-		llvm::Value *j = (*i)->Codegen();
+	for (auto i = vec.begin(); i != vec.end(); i++) { 
+		llvm::Value *j = (*i)->Codegen(ctx);
 		if (j != NULL) { val = j; }
 	}	
 	return val;
 }
+#endif
 
 /// decafStmtList - List of Decaf statements
 class decafStmtList : public decafAST {
-	list<decafAST *> stmts;
+	decafList stmts;
 public:
 	decafStmtList() {}
-	~decafStmtList() {
-		for (list<decafAST *>::iterator i = stmts.begin(); i != stmts.end(); i++) { 
-			delete *i;
-		}
-	}
 	int size() { return stmts.size(); }
 	void push_front(decafAST *e) { stmts.push_front(e); }
 	void push_back(decafAST *e) { stmts.push_back(e); }
-	list<decafAST *> getList() { return stmts; }
-	string str() { return commaList<class decafAST *>(stmts); }
-	vector<llvm::Value *> getArgs() {
+	const decafList &getList() { return stmts; }
+	string str() { return commaList(stmts); }
+#ifndef DECAF_NO_LLVM
+	vector<llvm::Value *> getArgs(decafContext &ctx) {
 		vector<llvm::Value *> args;
-		for (list<class decafAST *>::iterator i = stmts.begin(); i != stmts.end(); i++){
-			args.push_back((*i)->Codegen());
+		for (decafList::iterator i = stmts.begin(); i != stmts.end(); i++){
+			args.push_back((*i)->Codegen(ctx));
 		}
 		return args;
 	}
-	list<decafAST *>::iterator begin() { return stmts.begin(); }
-	list<decafAST *>::iterator end() { return stmts.end(); }
-	llvm::Value *Codegen() { 
-		return listCodegen<decafAST *>(stmts); 
+#endif
+	decafList::iterator begin() { return stmts.begin(); }
+	decafList::iterator end() { return stmts.end(); }
+#ifndef DECAF_NO_LLVM
+	llvm::Value *Codegen(decafContext &ctx) { 
+		return listCodegen(ctx, stmts); 
+	}
+#endif
+	int Lower(vmLowering &vm) {
+		int reg = -1;
+		for (decafAST *stmt : stmts) { reg = stmt->Lower(vm); }
+		return reg;
+	}
+	decafAST *Optimize(astOptimizer &opt) {
+		for (decafAST *stmt : stmts) {
+			stmt->Optimize(opt);
+			opt.reads.clear();
+		}
+		return this;
+	}
+	void Resolve(decafResolver &res) {
+		for (decafAST *stmt : stmts) { stmt->Resolve(res); }
+	}
+	// optimize a method's arguments, each an expression
+	void optimizeArgs(astOptimizer &opt) {
+		for (decafList::iterator i = stmts.begin(); i != stmts.end(); i++) { *i = opt.expr(*i); }
+	}
+#ifndef DECAF_NO_LLVM
+	// generate a statement list.  Statements after a return, break or
+	// continue still go through Codegen for their semantic errors, into
+	// a block with no predecessors that decaf_codegen removes.
+	void codegenStatements(decafContext &ctx) {
+		for (decafAST *stmt : stmts) {
+			if (ctx.terminated()) {
+				llvm::Function *func = ctx.Builder.GetInsertBlock()->getParent();
+				ctx.Builder.SetInsertPoint(llvm::BasicBlock::Create(ctx.TheContext, "dead", func));
+				ctx.seal(ctx.Builder.GetInsertBlock());
+			}
+			stmt->Codegen(ctx);
+		}
+	}
+#endif
+	// lower a statement list, freeing each statement's temporaries after it
+	void lowerStatements(vmLowering &vm) {
+		int outer = vm.locals;
+		vm.locals = vm.next;
+		for (decafAST *stmt : stmts) {
+			stmt->Lower(vm);
+			vm.next = vm.locals;
+		}
+		vm.locals = outer;
 	}
 };
 
@@ -156,337 +789,751 @@ class BlockAST : public decafAST {
 	decafStmtList *statement_list;
 public:
 	BlockAST(decafStmtList *v, decafStmtList *s) : var_decl_list(v), statement_list(s) {}
-	~BlockAST() {
-		if (var_decl_list != NULL) { delete var_decl_list; }
-		if (statement_list != NULL) { delete statement_list; }
-	}
 	string str() { return string("Block") + "(" + getString(var_decl_list) + "," + getString(statement_list) + ")"; }
-	llvm::Value *Codegen() {
-		symtbl.push_front(symbol_table());
+#ifndef DECAF_NO_LLVM
+	llvm::Value *Codegen(decafContext &ctx) {
+		ctx.open_block();
 
-		if (var_decl_list != NULL) { var_decl_list->Codegen(); }
-		if (statement_list != NULL) { statement_list->Codegen(); }
+		if (var_decl_list != NULL) { var_decl_list->Codegen(ctx); }
+		if (statement_list != NULL) { statement_list->codegenStatements(ctx); }
 
-		symbol_table st = symtbl.front();
-		symtbl.pop_front();
+		ctx.close_block();
 
 		return NULL;
 	}
+#endif
+	int Lower(vmLowering &vm) {
+		int mark = vm.next;
+		if (var_decl_list != NULL) { var_decl_list->Lower(vm); }
+		if (statement_list != NULL) { statement_list->lowerStatements(vm); }
+		vm.next = mark;
+		return -1;
+	}
+	decafAST *Optimize(astOptimizer &opt) {
+		opt.forget();
+		opt.names.push_scope();
+		if (var_decl_list != NULL) { var_decl_list->Optimize(opt); }
+		if (statement_list != NULL) { statement_list->Optimize(opt); }
+		opt.names.pop_scope();
+		opt.forget();
+		return this;
+	}
+	void Resolve(decafResolver &res) {
+		res.names.push_scope();
+		if (var_decl_list != NULL) { var_decl_list->Resolve(res); }
+		if (statement_list != NULL) { statement_list->Resolve(res); }
+		res.names.pop_scope();
+	}
 };
 
 class ConstantAST : public decafAST {
-	string type;
-	string val;
+	decafConst kind;
+	llvm::StringRef val;
+	int ival;	// value of a NumberExpr or BoolExpr, decoded once at parse time
 public:
-	ConstantAST(string type, string val) : type(type), val(val) {}
-	string str() { return type + "(" + val + ")"; }
-	llvm::Value *Codegen() { 
+	ConstantAST(decafConst kind, llvm::StringRef val) : kind(kind), val(val), ival(0) {
+		if (kind == ConstNumber) { ival = strtoint(val.str()); }
+		else if (kind == ConstBool) { ival = (val == "True"); }
+	}
+	// a constant astOptimizer folded
+	ConstantAST(decafConst kind, int value)
+		: kind(kind), val(arena_str(kind == ConstBool ? (value ? "True" : "False") : to_string(value))), ival(value) {}
+	string str() { return string(constNames[kind]) + "(" + val.str() + ")"; }
+	int value() { return ival; }
+	// the characters of a StringConstant, quotes removed and escapes decoded
+	string text() {
+		string s = "";
+
+		for (int i = 1; i < val.size()-1; i++) {
+			if (val[i] != '\\') {
+				s.push_back(val[i]);
+			}
+			else {
+				switch(val[i+1]){
+					case 'a':  s.push_back('\a'); break;
+      					case 'b':  s.push_back('\b'); break;
+      					case 't':  s.push_back('\t'); break;
+					case 'n':  s.push_back('\n'); break;
+					case 'v':  s.push_back('\v'); break;
+					case 'f':  s.push_back('\f'); break;
+					case 'r':  s.push_back('\r'); break;
+					case '\\': s.push_back('\\'); break;
+					case '\'': s.push_back('\''); break;
+					case '\"': s.push_back('\"'); break;
+				}
+				i++;
+			}
+		}
+		return s;
+	}
+#ifndef DECAF_NO_LLVM
+	llvm::Value *Codegen(decafContext &ctx) { 
 		llvm::Constant *Const = NULL;
 
-		if (type == "NumberExpr") { 
-			Const = Builder.getInt32(strtoint(val));
+		if (kind == ConstNumber) { 
+			Const = ctx.Builder.getInt32(ival);
 
-		} else if (type == "BoolExpr") {
-			if (val == "True") { Const = Builder.getInt1(1); }
-			if (val == "False") { Const = Builder.getInt1(0); }
+		} else if (kind == ConstBool) {
+			Const = ctx.Builder.getInt1(ival);
 
 			return (llvm::Value*)Const;
 
-		} else if (type == "StringConstant") {
-			string s = "";
-
-			for (int i = 1; i < val.length()-1; i++) {
-				if (val[i] != '\\') {
-					s.push_back(val[i]);
-				}
-				else {
-					switch(val[i+1]){
-						case 'a':  s.push_back('\a'); break;
-      					case 'b':  s.push_back('\b'); break;
-      					case 't':  s.push_back('\t'); break;
-						case 'n':  s.push_back('\n'); break;
-						case 'v':  s.push_back('\v'); break;
-						case 'f':  s.push_back('\f'); break;
-						case 'r':  s.push_back('\r'); break;
-						case '\\': s.push_back('\\'); break;
-						case '\'': s.push_back('\''); break;
-						case '\"': s.push_back('\"'); break;
-					}
-					i++;
-				}
-			}
-			llvm::GlobalVariable *GV = Builder.CreateGlobalString(s.c_str(), "globalstring");
-			return Builder.CreateConstGEP2_32(GV->getValueType(), GV, 0, 0, "cast");
+		} else if (kind == ConstString) {
+			llvm::GlobalVariable *GV = ctx.Builder.CreateGlobalString(text().c_str(), "globalstring");
+			return ctx.Builder.CreateConstGEP2_32(GV->getValueType(), GV, 0, 0, "cast");
 		}
 
 		return (llvm::Value*)Const;
 	}
+	// a constant condition goes straight to the branch it picks
+	llvm::Value *CondCodegen(decafContext &ctx, llvm::BasicBlock *TrueBB, llvm::BasicBlock *FalseBB) {
+		if (kind != ConstBool) { return decafAST::CondCodegen(ctx, TrueBB, FalseBB); }
+		ctx.Builder.CreateBr(ival ? TrueBB : FalseBB);
+		return ctx.Builder.getInt1(ival);
+	}
+#endif
+	int Lower(vmLowering &vm) {
+		int reg = vm.temp();
+		vm.type = kind == ConstNumber ? TypeInt : kind == ConstBool ? TypeBool : TypeString;
+		if (kind == ConstString) {
+			vm.program.strings.push_back(text());
+			vm.emit(VmConst, reg, vm.program.strings.size() - 1);
+		} else {
+			vm.emit(VmConst, reg, ival);
+		}
+		return reg;
+	}
+	decafAST *Optimize(astOptimizer &opt) {
+		opt.nodes++;
+		opt.type = kind == ConstNumber ? TypeInt : kind == ConstBool ? TypeBool : TypeString;
+		opt.number = kind == ConstString ? opt.fresh() : opt.value_number(ValueConstant, kind, ival);
+		return this;
+	}
+	ConstantAST *constant() { return this; }
 };
 
 class BinaryExprAST : public decafAST {
-	string op;
+	decafOp op;
 	decafAST *LHS;
 	decafAST *RHS;
 public:
-	BinaryExprAST(string op, decafAST *LHS, decafAST *RHS) : op(op), LHS(LHS), RHS(RHS) {}
-	~BinaryExprAST() {
-		if (LHS != NULL) { delete LHS; }
-		if (RHS != NULL) { delete RHS; }
-	}
+	BinaryExprAST(decafOp op, decafAST *LHS, decafAST *RHS) : op(op), LHS(LHS), RHS(RHS) {}
 	string str() {
-		string res = "";
-		if (op.compare("T_MULT") == 0) { res = "Mult"; }
-		else if (op.compare("T_DIV") == 0) { res = "Div"; }
-		else if (op.compare("T_MOD") == 0) { res = "Mod"; }
-		else if (op.compare("T_PLUS") == 0) { res = "Plus"; }
-		else if (op.compare("T_MINUS") == 0) { res = "Minus"; }
-		else if (op.compare("T_LEFTSHIFT") == 0) { res = "Leftshift"; }
-		else if (op.compare("T_RIGHTSHIFT") == 0) { res = "Rightshift"; }
-		else if (op.compare("T_EQ") == 0) { res = "Eq"; }
-		else if (op.compare("T_NEQ") == 0) { res = "Neq"; }
-		else if (op.compare("T_GEQ") == 0) { res = "Geq"; }
-		else if (op.compare("T_LEQ") == 0) { res = "Leq"; }
-		else if (op.compare("T_GT") == 0) { res = "Gt"; }
-		else if (op.compare("T_LT") == 0) { res = "Lt"; }
-		else if (op.compare("T_AND") == 0) { res = "And"; }
-		else if (op.compare("T_OR") == 0) { res = "Or"; }
-		
-		return string("BinaryExpr") + "(" + res + "," + LHS->str() + "," + RHS->str() + ")";
-	}
-	llvm::Value *Codegen() {
-		// llvm::Value* lval = LHS->Codegen();
-		// llvm::Value* rval = RHS->Codegen();
-		llvm::Value* lval;
-    	llvm::Value* rval;
-
-		llvm::BasicBlock *CurBB;
-		llvm::BasicBlock* RBB;
-		llvm::Function *func;
-		llvm::BasicBlock* MergeBB;
-		llvm::PHINode* phi;
-
-		if ((op.compare("T_AND") != 0) && (op.compare("T_OR") != 0)) {
-			lval = LHS->Codegen();
-      		rval = RHS->Codegen();
-		} else {
-			CurBB = Builder.GetInsertBlock();
-			func = CurBB->getParent();
-			RBB = llvm::BasicBlock::Create(TheContext, "rval", func); 
-			MergeBB = llvm::BasicBlock::Create(TheContext, "merge", func); 
-		}
-
-		if(op.compare("T_MULT") == 0) { return Builder.CreateMul(lval, rval, "multmp"); }
-		if(op.compare("T_DIV") == 0) { return Builder.CreateSDiv(lval, rval, "divtmp"); }
-		if(op.compare("T_MOD") == 0) { return Builder.CreateSRem(lval, rval, "modtmp"); }
-		if(op.compare("T_PLUS") == 0) { return Builder.CreateAdd(lval, rval, "addtmp"); }
-		if(op.compare("T_MINUS") == 0) { return Builder.CreateSub(lval, rval, "subtmp"); }
-		if(op.compare("T_LEFTSHIFT") == 0) { return Builder.CreateShl(lval, rval, "lstmp"); }
-		if(op.compare("T_RIGHTSHIFT") == 0) { return Builder.CreateLShr(lval, rval, "rstmp"); }
-		if(op.compare("T_EQ") == 0) { return Builder.CreateICmpEQ(lval, rval, "eqtmp"); }
-		if(op.compare("T_NEQ") == 0) { return Builder.CreateICmpNE(lval, rval, "neqtmp");}
-		if(op.compare("T_GEQ") == 0) { return Builder.CreateICmpSGE(lval, rval, "geqtmp"); }
-		if(op.compare("T_LEQ") == 0) { return Builder.CreateICmpSLE(lval, rval, "leqtmp"); }
-		if(op.compare("T_GT") == 0) { return Builder.CreateICmpSGT(lval, rval, "gttmp"); }
-		if(op.compare("T_LT") == 0) { return Builder.CreateICmpSLT(lval, rval, "lttmp"); }
-		if(op.compare("T_AND") == 0) { 
-			// return Builder.CreateAnd(lval, rval, "andtmp");
-
-			lval = LHS->Codegen();
-			Builder.CreateCondBr(lval, RBB, MergeBB);
-			Builder.SetInsertPoint(RBB);
-			rval = RHS->Codegen();
-			RBB = Builder.GetInsertBlock();
-			Builder.CreateBr(MergeBB);        
-	
-			Builder.SetInsertPoint(MergeBB);                     
-			phi = Builder.CreatePHI(lval->getType(), 2, "phival"); 
-			phi->addIncoming(lval, CurBB);
-			phi->addIncoming(rval, RBB);
-	
-			return (llvm::Value*)phi;
+		return string("BinaryExpr") + "(" + opNames[op] + "," + LHS->str() + "," + RHS->str() + ")";
+	}
+#ifndef DECAF_NO_LLVM
+	llvm::Value *Codegen(decafContext &ctx) {
+		if (op == OpAnd || op == OpOr) {
+			return shortCircuitCodegen(ctx);
 		}
-		if(op.compare("T_OR") == 0) { 
-			//return Builder.CreateOr(lval, rval, "ortmp");
 
-			lval = LHS->Codegen();
-			Builder.CreateCondBr(lval, MergeBB, RBB);
-			Builder.SetInsertPoint(RBB);
-			rval = RHS->Codegen();
-			RBB = Builder.GetInsertBlock();
-			Builder.CreateBr(MergeBB);        
-
-			Builder.SetInsertPoint(MergeBB);                     
-			phi = Builder.CreatePHI(lval->getType(), 2, "phival"); 
-			phi->addIncoming(lval, CurBB);
-			phi->addIncoming(rval, RBB);
-			
-			return (llvm::Value*)phi;
+		// == and != compare booleans too; both sides have one type
+		llvm::Value* lval = LHS->Codegen(ctx);
+		bool boolean = (op == OpEq || op == OpNeq) && lval->getType()->isIntegerTy(1);
+		expect_operand(lval, boolean ? TypeBool : TypeInt, op);
+		llvm::Value* rval = RHS->Codegen(ctx);
+		expect_operand(rval, boolean ? TypeBool : TypeInt, op);
+
+		switch (op) {
+		case OpMult: return ctx.Builder.CreateMul(lval, rval, "multmp");
+		case OpDiv: return ctx.Builder.CreateSDiv(lval, rval, "divtmp");
+		case OpMod: return ctx.Builder.CreateSRem(lval, rval, "modtmp");
+		case OpPlus: return ctx.Builder.CreateAdd(lval, rval, "addtmp");
+		case OpMinus: return ctx.Builder.CreateSub(lval, rval, "subtmp");
+		case OpLeftShift: return ctx.Builder.CreateShl(lval, rval, "lstmp");
+		case OpRightShift: return ctx.Builder.CreateLShr(lval, rval, "rstmp");
+		case OpEq: return ctx.Builder.CreateICmpEQ(lval, rval, "eqtmp");
+		case OpNeq: return ctx.Builder.CreateICmpNE(lval, rval, "neqtmp");
+		case OpGeq: return ctx.Builder.CreateICmpSGE(lval, rval, "geqtmp");
+		case OpLeq: return ctx.Builder.CreateICmpSLE(lval, rval, "leqtmp");
+		case OpGt: return ctx.Builder.CreateICmpSGT(lval, rval, "gttmp");
+		case OpLt: return ctx.Builder.CreateICmpSLT(lval, rval, "lttmp");
+		default: return NULL;
 		}
-
+	}
+	// && and || only evaluate RHS when LHS does not decide the result
+	llvm::Value *shortCircuitCodegen(decafContext &ctx) {
+		llvm::Value* lval = LHS->Codegen(ctx);
+		expect_operand(lval, TypeBool, op);
+		// LHS may itself have branched, so take the block it finished in
+		llvm::BasicBlock *CurBB = ctx.Builder.GetInsertBlock();
+		llvm::Function *func = CurBB->getParent();
+		llvm::BasicBlock* RBB = llvm::BasicBlock::Create(ctx.TheContext, "rval", func); 
+		llvm::BasicBlock* MergeBB = llvm::BasicBlock::Create(ctx.TheContext, "merge", func); 
+
+		if (op == OpAnd) {
+			ctx.Builder.CreateCondBr(lval, RBB, MergeBB);
+		} else {
+			ctx.Builder.CreateCondBr(lval, MergeBB, RBB);
+		}
+		ctx.seal(RBB);
+		ctx.Builder.SetInsertPoint(RBB);
+		llvm::Value* rval = RHS->Codegen(ctx);
+		expect_operand(rval, TypeBool, op);
+		RBB = ctx.Builder.GetInsertBlock();
+		ctx.Builder.CreateBr(MergeBB);        
+
+		ctx.seal(MergeBB);
+		ctx.Builder.SetInsertPoint(MergeBB);                     
+		llvm::PHINode* phi = ctx.Builder.CreatePHI(lval->getType(), 2, "phival"); 
+		phi->addIncoming(lval, CurBB);
+		phi->addIncoming(rval, RBB);
+
+		return (llvm::Value*)phi;
+	}
+	// as a condition, && and || branch to the targets from each operand
+	// and never merge into a value
+	llvm::Value *CondCodegen(decafContext &ctx, llvm::BasicBlock *TrueBB, llvm::BasicBlock *FalseBB) {
+		if (op != OpAnd && op != OpOr) { return decafAST::CondCodegen(ctx, TrueBB, FalseBB); }
+		llvm::Function *func = ctx.Builder.GetInsertBlock()->getParent();
+		llvm::BasicBlock *RBB = llvm::BasicBlock::Create(ctx.TheContext, op == OpAnd ? "andrhs" : "orrhs", func);
+		if (op == OpAnd) {
+			LHS->CondCodegen(ctx, RBB, FalseBB);
+		} else {
+			LHS->CondCodegen(ctx, TrueBB, RBB);
+		}
+		ctx.seal(RBB);
+		ctx.Builder.SetInsertPoint(RBB);
+		RHS->CondCodegen(ctx, TrueBB, FalseBB);
 		return NULL;
 	}
+#endif
+	int Lower(vmLowering &vm) {
+		// indexed by decafOp, up to OpLt
+		static const decafVmOp vmOps[] = {
+			VmMul, VmDiv, VmMod, VmAdd, VmSub, VmShl, VmShr,
+			VmEq, VmNe, VmGe, VmLe, VmGt, VmLt
+		};
+		if (op == OpAnd || op == OpOr) {
+			int dst = vm.temp();
+			int lreg = LHS->Lower(vm);
+			vm.expect(TypeBool, "operand", opNames[op]);
+			vm.move(dst, lreg);
+			int skip = vm.emit(op == OpAnd ? VmJumpIfZero : VmJumpIfNotZero, dst);
+			int rreg = RHS->Lower(vm);
+			vm.expect(TypeBool, "operand", opNames[op]);
+			vm.move(dst, rreg);
+			vm.patch(skip, vm.label());
+			vm.type = TypeBool;
+			return dst;
+		}
+		// == and != compare booleans too; both sides have one type
+		int lreg = LHS->Lower(vm);
+		decafType ltype = vm.type;
+		if (!((op == OpEq || op == OpNeq) && ltype == TypeBool)) { vm.expect(TypeInt, "operand", opNames[op]); }
+		int rreg = RHS->Lower(vm);
+		vm.expect(ltype, "operand", opNames[op]);
+		int32_t imm;
+		if ((op == OpPlus || op == OpMinus) && vm.constant(rreg, imm)) {
+			int dst = vm.temp();
+			vm.emit(VmAddImm, dst, lreg, op == OpPlus ? imm : (int32_t)(0u - (uint32_t)imm));
+			vm.type = TypeInt;
+			return dst;
+		}
+		int dst = vm.temp();
+		vm.emit(vmOps[op], dst, lreg, rreg);
+		vm.type = op >= OpEq ? TypeBool : TypeInt;
+		return dst;
+	}
+	// the type of the result given the operands', TypeNone if they do not check
+	static decafType resultType(decafOp op, decafType l, decafType r) {
+		if (l != r) { return TypeNone; }
+		switch (op) {
+		case OpEq: case OpNeq: return l == TypeInt || l == TypeBool ? TypeBool : TypeNone;
+		case OpAnd: case OpOr: return l == TypeBool ? TypeBool : TypeNone;
+		default: return l != TypeInt ? TypeNone : op >= OpEq ? TypeBool : TypeInt;
+		}
+	}
+	// a op b as the generated code computes it; false where that is a
+	// trap or undefined (division by zero or of INT_MIN by -1, shifts by
+	// 32 or more), which is left to happen at run time
+	static bool fold(decafOp op, int32_t a, int32_t b, int32_t &result) {
+		uint32_t x = a, y = b;
+		switch (op) {
+		case OpMult: result = x * y; return true;
+		case OpPlus: result = x + y; return true;
+		case OpMinus: result = x - y; return true;
+		case OpDiv: case OpMod:
+			if (b == 0 || (a == INT_MIN && b == -1)) { return false; }
+			result = op == OpDiv ? a / b : a % b;
+			return true;
+		case OpLeftShift: case OpRightShift:
+			// a count of 32 or more is poison in the IR (and undefined
+			// here), so it is left for run time
+			if (y >= 32) { return false; }
+			result = op == OpLeftShift ? x << y : x >> y;
+			return true;
+		case OpEq: result = a == b; return true;
+		case OpNeq: result = a != b; return true;
+		case OpGeq: result = a >= b; return true;
+		case OpLeq: result = a <= b; return true;
+		case OpGt: result = a > b; return true;
+		case OpLt: result = a < b; return true;
+		case OpAnd: result = a && b; return true;
+		case OpOr: result = a || b; return true;
+		default: return false;
+		}
+	}
+	decafAST *Optimize(astOptimizer &opt) {
+		opt.nodes++;
+		bool logical = op == OpAnd || op == OpOr;
+		// an operand with calls or traps is never dropped
+		int effects = opt.calls + opt.traps, before = opt.live();
+		LHS = opt.expr(LHS);
+		decafType ltype = opt.type;
+		int lnumber = opt.number;
+		int lsize = opt.live() - before;
+		bool lpure = opt.calls + opt.traps == effects;
+
+		// the right operand of && and || does not always run
+		effects = opt.calls + opt.traps, before = opt.live();
+		if (logical) { opt.conditional++; }
+		RHS = opt.expr(RHS);
+		if (logical) { opt.conditional--; }
+		int rsize = opt.live() - before;
+		bool rpure = opt.calls + opt.traps == effects;
+		int rnumber = opt.number;
+
+		opt.type = resultType(op, ltype, opt.type);
+		if (opt.type == TypeNone) {
+			opt.number = opt.fresh();
+			return this;
+		}
+		opt.number = opt.value_number(op, lnumber, rnumber);
+		ConstantAST *l = LHS->constant(), *r = RHS->constant();
+		int32_t value;
+		if (l != NULL && r != NULL && fold(op, l->value(), r->value(), value)) {
+			opt.stats.folded += 2;
+			decafConst kind = opt.type == TypeBool ? ConstBool : ConstNumber;
+			opt.number = opt.value_number(ValueConstant, kind, value);
+			return new ConstantAST(kind, value);
+		}
+		if ((op == OpDiv || op == OpMod) && (r == NULL || r->value() == 0 || r->value() == -1)) { opt.traps++; }
+		if (l == NULL && r == NULL) { return this; }
+
+		// identities: x + 0, x * 1, true && x and the like are x, and
+		// x * 0, false && x and true || x are the constant
+		int identity = -1, absorbing = -1;
+		bool commutes = true;
+		switch (op) {
+		case OpPlus: identity = 0; break;
+		case OpMinus: case OpLeftShift: case OpRightShift: identity = 0; commutes = false; break;
+		case OpDiv: identity = 1; commutes = false; break;
+		case OpMult: identity = 1; absorbing = 0; break;
+		case OpAnd: identity = 1; absorbing = 0; break;
+		case OpOr: identity = 0; absorbing = 1; break;
+		case OpEq: if (ltype == TypeBool) { identity = 1; } break;
+		case OpNeq: if (ltype == TypeBool) { identity = 0; } break;
+		default: break;
+		}
+		decafAST *result = NULL;
+		if (r != NULL && r->value() == identity) { result = LHS; }
+		else if (l != NULL && commutes && l->value() == identity) { result = RHS; }
+		else if (r != NULL && r->value() == absorbing && lpure) { result = RHS; }
+		else if (l != NULL && l->value() == absorbing && rpure) { result = LHS; }
+		if (result == NULL) { return this; }
+		opt.stats.simplified += 1 + lsize + rsize - (result == LHS ? lsize : rsize);
+		// both operands have the type of the result
+		opt.type = ltype;
+		opt.number = result == LHS ? lnumber : rnumber;
+		return result;
+	}
+	void Resolve(decafResolver &res) {
+		LHS->Resolve(res);
+		RHS->Resolve(res);
+	}
+	bool shareable() { return true; }
 };
 
 class UnaryExprAST : public decafAST {
-	string op;
+	decafOp op;
 	decafAST *LHS;
 public:
-	UnaryExprAST(string op, decafAST *LHS) : op(op), LHS(LHS) {}
-	~UnaryExprAST() {
-		if (LHS != NULL) { delete LHS; }
-	}
+	UnaryExprAST(decafOp op, decafAST *LHS) : op(op), LHS(LHS) {}
 	string str() {
-		string res = "";
-		if (op.compare("T_NOT") == 0) { res = "Not"; }
-		else if (op.compare("T_UMINUS") == 0) { res = "UnaryMinus"; }
-		
-		return string("UnaryExpr") + "(" + res + "," + LHS->str() + ")";
+		return string("UnaryExpr") + "(" + opNames[op] + "," + LHS->str() + ")";
 	}
 
-	llvm::Value *Codegen() {
-	  	llvm::Value* lval = LHS->Codegen();
-
-		if (op.compare("T_NOT") == 0) { return Builder.CreateNot(lval, "unottmp"); }
-		if (op.compare("T_UMINUS") == 0) { return Builder.CreateNeg(lval, "unegtmp"); }
+#ifndef DECAF_NO_LLVM
+	llvm::Value *Codegen(decafContext &ctx) {
+	  	llvm::Value* lval = LHS->Codegen(ctx);
+		expect_operand(lval, op == OpNot ? TypeBool : TypeInt, op);
 
-		return NULL;
+		switch (op) {
+		case OpNot: return ctx.Builder.CreateNot(lval, "unottmp");
+		case OpUnaryMinus: return ctx.Builder.CreateNeg(lval, "unegtmp");
+		default: return NULL;
+		}
   	}
+	// ! as a condition swaps the targets
+	llvm::Value *CondCodegen(decafContext &ctx, llvm::BasicBlock *TrueBB, llvm::BasicBlock *FalseBB) {
+		if (op != OpNot) { return decafAST::CondCodegen(ctx, TrueBB, FalseBB); }
+		LHS->CondCodegen(ctx, FalseBB, TrueBB);
+		return NULL;
+	}
+#endif
+	int Lower(vmLowering &vm) {
+		int src = LHS->Lower(vm);
+		vm.expect(op == OpNot ? TypeBool : TypeInt, "operand", opNames[op]);
+		int dst = vm.temp();
+		vm.emit(op == OpNot ? VmNot : VmNeg, dst, src);
+		vm.type = op == OpNot ? TypeBool : TypeInt;
+		return dst;
+	}
+	decafAST *Optimize(astOptimizer &opt) {
+		opt.nodes++;
+		LHS = opt.expr(LHS);
+		decafType type = op == OpNot ? TypeBool : TypeInt;
+		if (opt.type != type) {
+			opt.type = TypeNone;
+			opt.number = opt.fresh();
+			return this;
+		}
+		if (ConstantAST *c = LHS->constant()) {
+			opt.stats.folded++;
+			int32_t value = op == OpNot ? !c->value() : (int32_t)(0u - (uint32_t)c->value());
+			opt.number = opt.value_number(ValueConstant, op == OpNot ? ConstBool : ConstNumber, value);
+			return new ConstantAST(op == OpNot ? ConstBool : ConstNumber, value);
+		}
+		opt.number = opt.value_number(op, opt.number);
+		return this;
+	}
+	void Resolve(decafResolver &res) { LHS->Resolve(res); }
+	bool shareable() { return true; }
 };
 
 class VariableExprAST : public decafAST {
-	string name;
+	llvm::StringRef name;
+	symbol_id sym;
+	decl_ref decl;		// set by Resolve()
 public:
-	VariableExprAST(string name) : name(name) {}
-	string getName() { return name; }
-	string str() { return string("VariableExpr") + "(" + name + ")"; }
-	llvm::Value *Codegen() {
-		llvm::Value* val = access_symtbl(name);
-		return Builder.CreateLoad(val, name);
+	VariableExprAST(symbol_id sym) : name(symbol_text(sym)), sym(sym) {}
+	llvm::StringRef getName() { return name; }
+	string str() { return string("VariableExpr") + "(" + name.str() + ")"; }
+#ifndef DECAF_NO_LLVM
+	llvm::Value *Codegen(decafContext &ctx) {
+		return ctx.load(ctx.variable(decl), name);
 	}
+#endif
+	int Lower(vmLowering &vm) {
+		vm_ref ref = vm.variable(decl);
+		vm.type = ref.type;
+		if (ref.kind == RefLocal) { return ref.index; }
+		int dst = vm.temp();
+		vm.emit(VmLoadGlobal, dst, ref.index);
+		return dst;
+	}
+	decafAST *Optimize(astOptimizer &opt) {
+		opt.nodes++;
+		ast_name ref = opt.names.lookup(sym);
+		opt.type = ref.kind == NameLocal || ref.kind == NameGlobal ? ref.type : TypeNone;
+		opt.number = opt.value_number(ValueVariable, sym);
+		opt.reads.push_back(sym);
+		return this;
+	}
+	void Resolve(decafResolver &res) { decl = res.variable(sym); }
+	bool shareable() { return true; }
 };
 
 class ArrayLocExprAST : public decafAST {
-	string name;
-	decafStmtList* index;
+	llvm::StringRef name;
+	symbol_id sym;
+	decafAST* index;
+	int array;		// among the globals, set by Resolve()
 public:
-	ArrayLocExprAST(string name, decafStmtList* index) : name(name), index(index) {}
-	string getName() { return name; }
-	string str() { return string("ArrayLocExpr") + "(" + name + "," + getString(index) + ")"; }
-	llvm::Value *Codegen() {
-
-		llvm::Value* val = access_symtbl(name);
+	ArrayLocExprAST(symbol_id sym, decafAST* index) : name(symbol_text(sym)), sym(sym), index(index) {}
+	llvm::StringRef getName() { return name; }
+	string str() { return string("ArrayLocExpr") + "(" + name.str() + "," + getString(index) + ")"; }
+#ifndef DECAF_NO_LLVM
+	llvm::Value *Codegen(decafContext &ctx) {
+		llvm::Type *type;
+		llvm::Value *ArrayIndex = ctx.element(array, index->Codegen(ctx), type);
+		return ctx.Builder.CreateLoad(type, ArrayIndex, "loadtmp");
+	}
+#endif
+	int Lower(vmLowering &vm) {
+		vm_ref ref = vm.globals[array];
+		int i = index->Lower(vm);
+		vm.expect(TypeInt, "array index");
+		int dst = vm.temp();
+		vm.emit(VmLoadArray, dst, ref.index, i);
+		vm.type = ref.type;
+		return dst;
+	}
+	decafAST *Optimize(astOptimizer &opt) {
+		opt.nodes++;
+		index = opt.expr(index);
+		ast_name ref = opt.names.lookup(sym);
+		opt.type = ref.kind == NameArray && opt.type == TypeInt ? ref.type : TypeNone;
+		opt.number = opt.value_number(ValueArrayLoc, sym, opt.number);
+		opt.reads.push_back(sym);
+		return this;
+	}
+	void Resolve(decafResolver &res) {
+		index->Resolve(res);
+		array = res.array(sym);
+	}
+	bool shareable() { return true; }
+};
 
-		llvm::GlobalVariable *GV = (llvm::GlobalVariable*)val;
-    	llvm::ArrayType *arrayi32 = (llvm::ArrayType*)GV->getType();
-    	llvm::Value *ArrayLoc = Builder.CreateStructGEP(arrayi32, GV, 0, "arrayloc");
-    	llvm::Value *i = index->Codegen();
-    	llvm::Value *ArrayIndex = Builder.CreateGEP(arrayi32->getElementType(), ArrayLoc, i, "arrayindex");
+/// SharedExprAST - an expression astOptimizer may reuse further on in
+/// the same basic block; it keeps the value it was generated to
+class SharedExprAST : public decafAST {
+	decafAST *expr;
+	llvm::Value *value;
+public:
+	SharedExprAST(decafAST *expr) : expr(expr), value(NULL) {}
+	decafAST *expression() { return expr; }
+	llvm::Value *generated() { return value; }
+	string str() { return expr->str(); }
+#ifndef DECAF_NO_LLVM
+	llvm::Value *Codegen(decafContext &ctx) { return value = expr->Codegen(ctx); }
+	// a condition that branched without a value leaves its reuses to
+	// compute it again
+	llvm::Value *CondCodegen(decafContext &ctx, llvm::BasicBlock *TrueBB, llvm::BasicBlock *FalseBB) {
+		return value = expr->CondCodegen(ctx, TrueBB, FalseBB);
+	}
+#endif
+	int Lower(vmLowering &vm) { return expr->Lower(vm); }
+	void Resolve(decafResolver &res) { expr->Resolve(res); }
+};
 
-		return Builder.CreateLoad(ArrayIndex, "loadtmp");
+/// ReuseExprAST - a repeat of a SharedExprAST that is still up to date,
+/// standing for the value it generated
+class ReuseExprAST : public decafAST {
+	SharedExprAST *shared;
+public:
+	ReuseExprAST(SharedExprAST *shared) : shared(shared) {}
+	string str() { return shared->str(); }
+#ifndef DECAF_NO_LLVM
+	llvm::Value *Codegen(decafContext &ctx) {
+		// an operand that was dropped, or that Codegen skips, never got
+		// its value; it is pure, so computing it here is just as good
+		llvm::Value *value = shared->generated();
+		return value != NULL ? value : shared->expression()->Codegen(ctx);
 	}
+#endif
+	// registers do not outlive a statement, so the vm computes it again
+	int Lower(vmLowering &vm) { return shared->expression()->Lower(vm); }
+	// the shared copy may have been dropped from the tree, and binds
+	// the same way here
+	void Resolve(decafResolver &res) { shared->expression()->Resolve(res); }
 };
 
+decafAST *astOptimizer::expr(decafAST *node) {
+	size_t first = reads.size();
+	int before = live(), calls_before = calls;
+	node = node->Optimize(*this);
+	if (type == TypeNone || calls != calls_before || !node->shareable()) { return node; }
+	auto found = avail.find(number);
+	if (found != avail.end()) {
+		stats.reused += live() - before;
+		reads.resize(first);
+		reads.insert(reads.end(), found->second.reads.begin(), found->second.reads.end());
+		return new ReuseExprAST(found->second.shared);
+	}
+	// only code that always runs makes a value available after it
+	if (conditional > 0) { return node; }
+	ast_available &added = avail[number];
+	added.shared = new SharedExprAST(node);
+	added.reads.assign(reads.begin() + first, reads.end());
+	bool global = false;
+	for (symbol_id sym : added.reads) {
+		readers[sym].push_back(number);
+		if (names.lookup(sym).kind != NameLocal) { global = true; }
+	}
+	if (global) { global_readers.push_back(number); }
+	return added.shared;
+}
+
 class MethodCallAST : public decafAST {
-	string name;
+	llvm::StringRef name;
+	symbol_id sym;
 	decafStmtList* method_arg_list;
+	int callee;		// among the functions, set by Resolve()
 public:
-	MethodCallAST(string name, decafStmtList* method_arg_list) : name(name), method_arg_list(method_arg_list) {}
-	~MethodCallAST() {
-		if (method_arg_list != NULL) { delete method_arg_list; }
-	}
+	MethodCallAST(symbol_id sym, decafStmtList* method_arg_list) : name(symbol_text(sym)), sym(sym), method_arg_list(method_arg_list) {}
 	string str() {
 		if (method_arg_list) {
-			return string("MethodCall") + "(" + name + "," + getString(method_arg_list) + ")";
+			return string("MethodCall") + "(" + name.str() + "," + getString(method_arg_list) + ")";
 		} else {
-			return string("MethodCall") + "(" + name + "," + "None" + ")";
+			return string("MethodCall") + "(" + name.str() + "," + "None" + ")";
 		}
 	}
-	llvm::Value *Codegen() {
-		llvm::Function *p_func = TheModule->getFunction(name);
+#ifndef DECAF_NO_LLVM
+	llvm::Value *Codegen(decafContext &ctx) {
+		llvm::Function *p_func = ctx.functions[callee];
 		
         std::vector<llvm::Value*> args;
-        for (auto it = method_arg_list->begin(); it != method_arg_list->end(); it++) {
-            args.push_back((*it)->Codegen());
-            if (!args.back()) {
-                return NULL;
+        if (method_arg_list != NULL) {
+            args.reserve(method_arg_list->size());
+            for (decafAST *arg : *method_arg_list) {
+                args.push_back(arg->Codegen(ctx));
+                if (!args.back()) {
+                    return NULL;
+                }
             }
         }
 
         int count = 0;
         for (auto it = p_func->arg_begin(); it != p_func->arg_end(); it++) {
             if (it->getType()->isIntegerTy(32) && args[count]->getType()->isIntegerTy(1)) {
-                args[count] = Builder.CreateIntCast(args[count], Builder.getInt32Ty(), false);
+                args[count] = ctx.Builder.CreateIntCast(args[count], ctx.Builder.getInt32Ty(), false);
             }
             count++;
         }
         if (p_func->getReturnType()->isVoidTy()) {
-            return Builder.CreateCall(p_func, args);
+            return ctx.Builder.CreateCall(p_func, args);
         }
-        return Builder.CreateCall(p_func, args, "calltmp");
+        return ctx.Builder.CreateCall(p_func, args, "calltmp");
 		
 	}
+#endif
+	int Lower(vmLowering &vm) {
+		vm_ref ref = vm.functions[callee];
+		int nargs = method_arg_list != NULL ? method_arg_list->size() : 0;
+		int dst = -1;
+		switch (ref.kind) {
+		case RefPrintInt:
+		case RefPrintString:
+			if (nargs != 1) { break; }
+			vm.emit(ref.kind == RefPrintInt ? VmPrintInt : VmPrintString, method_arg_list->Lower(vm));
+			vm.type = ref.type;
+			return dst;
+		case RefReadInt:
+			if (nargs != 0) { break; }
+			dst = vm.temp();
+			vm.emit(VmReadInt, dst);
+			vm.type = ref.type;
+			return dst;
+		case RefMethod: {
+			// Resolve() checked the number of arguments.  They go in
+			// consecutive registers, where the callee's frame will
+			// start; the result comes back in the first
+			dst = vm.temp();
+			for (int i = 1; i < nargs; i++) { vm.temp(); }
+			for (int i = 0; i < nargs; i++) {
+				int reg = (*(method_arg_list->begin() + i))->Lower(vm);
+				vm.move(dst + i, reg);
+			}
+			vm.emit(VmCall, dst, ref.index, dst);
+			vm.next = dst + 1;
+			vm.type = ref.type;
+			return dst;
+		}
+		case RefExtern:
+			throw runtime_error(name.str() + " is not built into the vm");
+		default:
+			throw runtime_error(name.str() + " is not a method");
+		}
+		throw runtime_error("wrong number of arguments to " + name.str());
+	}
+	decafAST *Optimize(astOptimizer &opt) {
+		opt.nodes++;
+		if (method_arg_list != NULL) { method_arg_list->optimizeArgs(opt); }
+		opt.calls++;
+		opt.kill_globals();
+		ast_name ref = opt.names.lookup(sym);
+		opt.type = ref.kind == NameMethod ? ref.type : TypeNone;
+		opt.number = opt.fresh();
+		return this;
+	}
+	void Resolve(decafResolver &res) {
+		callee = res.function(sym, method_arg_list != NULL ? method_arg_list->size() : 0);
+		if (method_arg_list != NULL) { method_arg_list->Resolve(res); }
+	}
 };
 
 class AssignVarAST : public decafAST {
-	string name;
+	llvm::StringRef name;
+	symbol_id sym;
 	decafAST* val;
+	decl_ref decl;		// set by Resolve()
 public:
-	AssignVarAST(string name, decafAST* val) : name(name), val(val) {}
-	~AssignVarAST() {
-		if (val != NULL) { delete val; }
-	}
-	string str() { return string("AssignVar") + "(" + name + "," + getString(val) + ")"; }
-	llvm::Value *Codegen() {
+	AssignVarAST(symbol_id sym, decafAST* val) : name(symbol_text(sym)), sym(sym), val(val) {}
+	string str() { return string("AssignVar") + "(" + name.str() + "," + getString(val) + ")"; }
+#ifndef DECAF_NO_LLVM
+	llvm::Value *Codegen(decafContext &ctx) {
 		
 		llvm::Value *value = NULL; 
-		llvm::Value *right = val->Codegen(); 
-    	llvm::Value *left = access_symtbl(name);
+		llvm::Value *right = val->Codegen(ctx); 
+    	llvm::Value *left = ctx.variable(decl);
 
 		if ((right->getType()->isIntegerTy(1) == true) && (left->getType()->isIntegerTy(32) == true)) {
-			right = Builder.CreateZExt(value, Builder.getInt32Ty(), "zexttmp");
+			right = ctx.Builder.CreateZExt(value, ctx.Builder.getInt32Ty(), "zexttmp");
 		}
 
 		if (left->getType() == right->getType()->getPointerTo()) {
-			return Builder.CreateStore(right, left);
+			ctx.store(right, left);
+			return right;
 		}
 		return NULL;
 	}
+#endif
+	int Lower(vmLowering &vm) {
+		vm_ref ref = vm.variable(decl);
+		int right = val->Lower(vm);
+		if (ref.kind == RefGlobal) {
+			vm.emit(VmStoreGlobal, ref.index, right);
+		} else {
+			vm.move(ref.index, right);
+		}
+		return -1;
+	}
+	decafAST *Optimize(astOptimizer &opt) {
+		val = opt.expr(val);
+		opt.kill(sym);
+		return this;
+	}
+	void Resolve(decafResolver &res) {
+		val->Resolve(res);
+		decl = res.variable(sym);
+	}
 };
 
 class AssignArrayLocAST : public decafAST {
-	string name;
+	llvm::StringRef name;
+	symbol_id sym;
 	decafAST* index;
 	decafAST* val;
+	int array;		// among the globals, set by Resolve()
 public:
-	AssignArrayLocAST(string name, decafAST* index, decafAST* val) : name(name), index(index), val(val) {}
-	~AssignArrayLocAST() {
-		if (index != NULL) { delete index; }
-		if (val != NULL) { delete val; }
+	AssignArrayLocAST(symbol_id sym, decafAST* index, decafAST* val) : name(symbol_text(sym)), sym(sym), index(index), val(val) {}
+	string str() { return string("AssignArrayLoc") + "(" + name.str() + "," + getString(index) + "," + getString(val) + ")"; }
+#ifndef DECAF_NO_LLVM
+	llvm::Value *Codegen(decafContext &ctx) {
+		llvm::Value *indexValue = index->Codegen(ctx);
+		llvm::Value *right = val->Codegen(ctx);
+		llvm::Type *type;
+		llvm::Value *left = ctx.element(array, indexValue, type);
+
+		if (right->getType()->isIntegerTy(1) && type->isIntegerTy(32)) {
+			right = ctx.Builder.CreateZExt(right, type, "zexttmp");
+		}
+		if (right->getType() != type) {
+			return NULL;
+		}
+		return ctx.Builder.CreateStore(right, left);
+	}
+#endif
+	int Lower(vmLowering &vm) {
+		vm_ref ref = vm.globals[array];
+		int i = index->Lower(vm);
+		vm.expect(TypeInt, "array index");
+		vm.emit(VmStoreArray, ref.index, i, val->Lower(vm));
+		return -1;
+	}
+	decafAST *Optimize(astOptimizer &opt) {
+		index = opt.expr(index);
+		val = opt.expr(val);
+		opt.kill(sym);
+		return this;
+	}
+	void Resolve(decafResolver &res) {
+		index->Resolve(res);
+		val->Resolve(res);
+		array = res.array(sym);
 	}
-	string str() { return string("AssignArrayLoc") + "(" + name + "," + getString(index) + "," + getString(val) + ")"; }
-	llvm::Value *Codegen() {
-		llvm::Value *value = NULL; 
-		llvm::Value *right;
-    	llvm::Value *left;	
-		llvm::GlobalVariable *GV = (llvm::GlobalVariable*)left;
-    	llvm::ArrayType *arrayi32 = (llvm::ArrayType*)GV->getType();
-    	llvm::Value *ArrayLoc = Builder.CreateStructGEP(arrayi32, GV, 0, "arrayloc");
-    	llvm::Value *indexValue = (index)->Codegen();
-    	llvm::Value *ArrayIndex = Builder.CreateGEP(arrayi32->getElementType(), ArrayLoc, indexValue, "arrayindex");
-
-    	left = ArrayIndex;
-		right = index->Codegen();
-
-		if ((right->getType()->isIntegerTy(1) == true) && (left->getType()->isIntegerTy(32) == true)) {  
-      		right = Builder.CreateZExt(right, Builder.getInt32Ty(), "zexttmp");    
-   		}
-
-    	const llvm::PointerType *ptrTy = right->getType()->getPointerTo();
-    	if (left->getType() == ptrTy) {
-      		value = Builder.CreateStore(right, left);
-    	}    
-		return value;          
-	} 
 };
 
 class IfStmtAST : public decafAST {
@@ -495,11 +1542,6 @@ class IfStmtAST : public decafAST {
 	BlockAST* else_block;
 public:
 	IfStmtAST(decafAST* condition, BlockAST* if_block, BlockAST* else_block) : condition(condition), if_block(if_block), else_block(else_block) {}
-	~IfStmtAST() {
-		if (condition != NULL) { delete condition; }
-		if (if_block != NULL) { delete if_block; }
-		if (else_block != NULL) { delete else_block; }
-	}
 	string str() { 
 		if (else_block) {
 			return string("IfStmt") + "(" + condition->str() + "," + if_block->str() + "," + else_block->str() + ")";
@@ -507,34 +1549,62 @@ public:
 			return string("IfStmt") + "(" + condition->str() + "," + if_block->str() + "," + "None" + ")";
 		}
 	}
-	llvm::Value *Codegen() {
-		llvm::Function *p_func = Builder.GetInsertBlock()->getParent();
-		llvm::BasicBlock* IfBB = llvm::BasicBlock::Create(TheContext, "if", p_func);
-		llvm::BasicBlock* IfTrueBB = llvm::BasicBlock::Create(TheContext, "iftrue", p_func);
-		llvm::BasicBlock* IfFalseBB = llvm::BasicBlock::Create(TheContext, "iffalse", p_func);
-		llvm::BasicBlock* EndBB = llvm::BasicBlock::Create(TheContext, "end", p_func);     
-
-		Builder.CreateBr(IfBB);
-		Builder.SetInsertPoint(IfBB);
-
-		llvm::Value* cond = condition->Codegen();
+#ifndef DECAF_NO_LLVM
+	llvm::Value *Codegen(decafContext &ctx) {
+		llvm::Function *p_func = ctx.Builder.GetInsertBlock()->getParent();
+		llvm::BasicBlock* IfTrueBB = llvm::BasicBlock::Create(ctx.TheContext, "iftrue", p_func);
+		llvm::BasicBlock* EndBB = llvm::BasicBlock::Create(ctx.TheContext, "end");     
+		// with no else the condition goes straight to the end
+		llvm::BasicBlock* IfFalseBB = else_block ? llvm::BasicBlock::Create(ctx.TheContext, "iffalse") : EndBB;
 
-		Builder.CreateCondBr(cond, IfTrueBB, IfFalseBB);
-		Builder.SetInsertPoint(IfTrueBB);
+		condition->CondCodegen(ctx, IfTrueBB, IfFalseBB);
+		ctx.seal(IfTrueBB);
+		ctx.Builder.SetInsertPoint(IfTrueBB);
 
-		if_block->Codegen();	// always do the if portion
-		Builder.CreateBr(EndBB);
-		Builder.SetInsertPoint(IfFalseBB);
+		if_block->Codegen(ctx);	// always do the if portion
+		ctx.branch(EndBB);
 
 		if (else_block) {
-			else_block->Codegen();
+			// an arm a constant condition never takes has no
+			// predecessors, and goes with the other unreachable blocks
+			IfFalseBB->insertInto(p_func);
+			ctx.seal(IfFalseBB);
+			ctx.Builder.SetInsertPoint(IfFalseBB);
+			else_block->Codegen(ctx);
+			ctx.branch(EndBB);
 		}
 
-		Builder.CreateBr(EndBB);
-		Builder.SetInsertPoint(EndBB);  
+		EndBB->insertInto(p_func);
+		ctx.seal(EndBB);
+		ctx.Builder.SetInsertPoint(EndBB);  
 
 		return NULL;
 	}
+#endif
+	int Lower(vmLowering &vm) {
+		int skip_if = vm.jump_unless(condition->Lower(vm));
+		if_block->Lower(vm);
+		if (else_block) {
+			int skip_else = vm.emit(VmJump);
+			vm.patch(skip_if, vm.label());
+			else_block->Lower(vm);
+			vm.patch(skip_else, vm.label());
+		} else {
+			vm.patch(skip_if, vm.label());
+		}
+		return -1;
+	}
+	decafAST *Optimize(astOptimizer &opt) {
+		condition = opt.expr(condition);
+		if_block->Optimize(opt);
+		if (else_block) { else_block->Optimize(opt); }
+		return this;
+	}
+	void Resolve(decafResolver &res) {
+		condition->Resolve(res);
+		if_block->Resolve(res);
+		if (else_block) { else_block->Resolve(res); }
+	}
 };
 
 class WhileStmtAST : public decafAST {
@@ -542,39 +1612,82 @@ class WhileStmtAST : public decafAST {
 	BlockAST* while_block;
 public:
 	WhileStmtAST(decafAST* condition, BlockAST* while_block) : condition(condition), while_block(while_block) {}
-	~WhileStmtAST() {
-		if (condition != NULL) { delete condition; }
-		if (while_block != NULL) { delete while_block; }
-	}
 	string str() { return string("WhileStmt") + "(" + condition->str() + "," + while_block->str() + ")"; }
-	llvm::Value *Codegen() { 
-		llvm::BasicBlock *CurBB = Builder.GetInsertBlock();
+#ifndef DECAF_NO_LLVM
+	// rotated: the condition is tested once before the loop and then at
+	// the bottom of each iteration, so an iteration takes one branch
+	//
+	//	guard:  cond ? whilepre : whileend
+	//	whilepre:  br whiletrue
+	//	whiletrue:  body; br whilestart
+	//	whilestart:  cond ? whiletrue : whileexit	(continue)
+	//	whileexit:  br whileend			(break)
+	llvm::Value *Codegen(decafContext &ctx) { 
+		llvm::BasicBlock *CurBB = ctx.Builder.GetInsertBlock();
 		llvm::Function *p_func = CurBB->getParent();
 	
-		llvm::BasicBlock* WhileStartBB = llvm::BasicBlock::Create(TheContext, "0_whilestart", p_func);
-		llvm::BasicBlock* WhileTrueBB = llvm::BasicBlock::Create(TheContext, "0_whiletrue", p_func);
-		llvm::BasicBlock* WhileEndBB = llvm::BasicBlock::Create(TheContext, "0_whileend", p_func);     
-
-		(symtbl.front())["0_loopstart"] = WhileStartBB;
-		(symtbl.front())["0_looptrue"] = WhileTrueBB; 
-		(symtbl.front())["0_loopend"] = WhileEndBB;
+		// the blocks after the body are placed once it is generated, so
+		// the function's blocks come in the order they run
+		llvm::BasicBlock* WhilePreBB = llvm::BasicBlock::Create(ctx.TheContext, "0_whilepre", p_func);
+		llvm::BasicBlock* WhileTrueBB = llvm::BasicBlock::Create(ctx.TheContext, "0_whiletrue", p_func);
+		llvm::BasicBlock* WhileStartBB = llvm::BasicBlock::Create(ctx.TheContext, "0_whilestart");
+		llvm::BasicBlock* WhileExitBB = llvm::BasicBlock::Create(ctx.TheContext, "0_whileexit");
+		llvm::BasicBlock* WhileEndBB = llvm::BasicBlock::Create(ctx.TheContext, "0_whileend");     
+
+		condition->CondCodegen(ctx, WhilePreBB, WhileEndBB);
+		ctx.seal(WhilePreBB);
+		ctx.Builder.SetInsertPoint(WhilePreBB);
+		ctx.Builder.CreateBr(WhileTrueBB);
 		
-		Builder.CreateBr(WhileStartBB);
-		Builder.SetInsertPoint(WhileStartBB);
-		llvm::Value* cond = condition->Codegen();
-		Builder.CreateCondBr(cond, WhileTrueBB, WhileEndBB);
-		
-		Builder.SetInsertPoint(WhileTrueBB);
-		while_block->Codegen(); 
-		Builder.CreateBr(WhileStartBB);   
-
-		Builder.SetInsertPoint(WhileEndBB);
-		(symtbl.front()).erase("0_loopstart");
-		(symtbl.front()).erase("0_looptrue") ;
-		(symtbl.front()).erase("0_loopend");
+		ctx.Builder.SetInsertPoint(WhileTrueBB);
+		ctx.loops.push_back(std::make_pair(WhileStartBB, WhileExitBB));
+		while_block->Codegen(ctx); 
+		ctx.loops.pop_back();
+		ctx.branch(WhileStartBB);   
+
+		// the body's end and its continues are all in now
+		WhileStartBB->insertInto(p_func);
+		ctx.seal(WhileStartBB);
+		ctx.Builder.SetInsertPoint(WhileStartBB);
+		condition->CondCodegen(ctx, WhileTrueBB, WhileExitBB);
+		ctx.seal(WhileTrueBB);
+		WhileExitBB->insertInto(p_func);
+		ctx.seal(WhileExitBB);
+		ctx.Builder.SetInsertPoint(WhileExitBB);
+		ctx.Builder.CreateBr(WhileEndBB);
+
+		WhileEndBB->insertInto(p_func);
+		ctx.seal(WhileEndBB);
+		ctx.Builder.SetInsertPoint(WhileEndBB);
 
 		return NULL;
 	}
+#endif
+	int Lower(vmLowering &vm) {
+		int start = vm.label();
+		int exit = vm.jump_unless(condition->Lower(vm));
+		vm.loops.push_back(vm_loop());
+		while_block->Lower(vm);
+		vm.emit(VmJump, start);
+		vm.patch(exit, vm.label());
+		vm.patch(vm.loops.back().breaks, vm.label());
+		vm.patch(vm.loops.back().continues, start);
+		vm.loops.pop_back();
+		return -1;
+	}
+	decafAST *Optimize(astOptimizer &opt) {
+		// the condition is also reached from the end of the body
+		opt.forget();
+		condition = opt.expr(condition);
+		while_block->Optimize(opt);
+		return this;
+	}
+	void Resolve(decafResolver &res) {
+		condition->Resolve(res);
+		res.loops++;
+		while_block->Resolve(res);
+		res.loops--;
+	}
 };
 
 class ForStmtAST : public decafAST {
@@ -585,50 +1698,90 @@ class ForStmtAST : public decafAST {
 public:
 	ForStmtAST(AssignVarAST* pre_assign_list, decafAST* condition, AssignVarAST* loop_assign_list, BlockAST* for_block) 
 		: pre_assign_list(pre_assign_list), condition(condition), loop_assign_list(loop_assign_list), for_block(for_block) {}
-	~ForStmtAST() {
-		if (pre_assign_list != NULL) { delete pre_assign_list; }
-		if (condition != NULL) { delete condition; }
-		if (loop_assign_list != NULL) { delete loop_assign_list; }
-		if (for_block != NULL) { delete for_block; }
-	}
 	string str() { return string("ForStmt") + "(" + pre_assign_list->str() + "," + condition->str() + "," + loop_assign_list->str() + "," + for_block->str() + ")"; }
-	llvm::Value *Codegen() {
+#ifndef DECAF_NO_LLVM
+	// rotated as WhileStmtAST, with the step at the top of the latch:
+	// forassign runs the step and then the test, and continue goes there
+	llvm::Value *Codegen(decafContext &ctx) {
 		
-		llvm::Function *p_func = Builder.GetInsertBlock()->getParent();
-		llvm::BasicBlock* ForBB = llvm::BasicBlock::Create(TheContext, "for", p_func);
-		llvm::BasicBlock* ForBodyBB = llvm::BasicBlock::Create(TheContext, "forbody", p_func);
-		llvm::BasicBlock* ForAssignBB = llvm::BasicBlock::Create(TheContext, "forassign", p_func);
-		llvm::BasicBlock* ForEndBB = llvm::BasicBlock::Create(TheContext, "forend", p_func);     
-
-		pre_assign_list->Codegen();
-		Builder.CreateBr(ForBB);
-		Builder.SetInsertPoint(ForBB);
-
-		llvm::Value* cond = condition->Codegen();
-
-		Builder.CreateCondBr(cond, ForBodyBB, ForEndBB);
-		Builder.SetInsertPoint(ForBodyBB);
-
-		for_block->Codegen();
-
-		Builder.CreateBr(ForAssignBB);
-		Builder.SetInsertPoint(ForAssignBB); 
-
-		loop_assign_list->Codegen();
-		Builder.CreateBr(ForBB);
-		Builder.SetInsertPoint(ForEndBB);
+		llvm::Function *p_func = ctx.Builder.GetInsertBlock()->getParent();
+		llvm::BasicBlock* ForPreBB = llvm::BasicBlock::Create(ctx.TheContext, "forpre", p_func);
+		llvm::BasicBlock* ForBodyBB = llvm::BasicBlock::Create(ctx.TheContext, "forbody", p_func);
+		llvm::BasicBlock* ForAssignBB = llvm::BasicBlock::Create(ctx.TheContext, "forassign");
+		llvm::BasicBlock* ForExitBB = llvm::BasicBlock::Create(ctx.TheContext, "forexit");
+		llvm::BasicBlock* ForEndBB = llvm::BasicBlock::Create(ctx.TheContext, "forend");     
+
+		pre_assign_list->Codegen(ctx);
+		condition->CondCodegen(ctx, ForPreBB, ForEndBB);
+		ctx.seal(ForPreBB);
+		ctx.Builder.SetInsertPoint(ForPreBB);
+		ctx.Builder.CreateBr(ForBodyBB);
+		ctx.Builder.SetInsertPoint(ForBodyBB);
+
+		ctx.loops.push_back(std::make_pair(ForAssignBB, ForExitBB));
+		for_block->Codegen(ctx);
+		ctx.loops.pop_back();
+
+		ctx.branch(ForAssignBB);
+		ForAssignBB->insertInto(p_func);
+		ctx.seal(ForAssignBB);
+		ctx.Builder.SetInsertPoint(ForAssignBB); 
+
+		loop_assign_list->Codegen(ctx);
+		condition->CondCodegen(ctx, ForBodyBB, ForExitBB);
+		ctx.seal(ForBodyBB);
+		ForExitBB->insertInto(p_func);
+		ctx.seal(ForExitBB);
+		ctx.Builder.SetInsertPoint(ForExitBB);
+		ctx.Builder.CreateBr(ForEndBB);
+		ForEndBB->insertInto(p_func);
+		ctx.seal(ForEndBB);
+		ctx.Builder.SetInsertPoint(ForEndBB);
 
 		return ForEndBB;
 	}
+#endif
+	int Lower(vmLowering &vm) {
+		int mark = vm.next;
+		pre_assign_list->Lower(vm);
+		vm.next = mark;
+		int start = vm.label();
+		int exit = vm.jump_unless(condition->Lower(vm));
+		vm.next = mark;
+		vm.loops.push_back(vm_loop());
+		for_block->Lower(vm);
+		vm.patch(vm.loops.back().continues, vm.label());
+		loop_assign_list->Lower(vm);
+		vm.next = mark;
+		vm.emit(VmJump, start);
+		vm.patch(exit, vm.label());
+		vm.patch(vm.loops.back().breaks, vm.label());
+		vm.loops.pop_back();
+		return -1;
+	}
+	decafAST *Optimize(astOptimizer &opt) {
+		pre_assign_list->Optimize(opt);
+		opt.forget();
+		condition = opt.expr(condition);
+		for_block->Optimize(opt);
+		loop_assign_list->Optimize(opt);
+		opt.forget();
+		return this;
+	}
+	void Resolve(decafResolver &res) {
+		pre_assign_list->Resolve(res);
+		condition->Resolve(res);
+		res.loops++;
+		for_block->Resolve(res);
+		res.loops--;
+		loop_assign_list->Resolve(res);
+	}
 };
 
 class ReturnStmtAST : public decafAST {
 	decafAST* return_value;
 public:
 	ReturnStmtAST(decafAST* return_value) : return_value(return_value) {}
-	~ReturnStmtAST() {
-		if (return_value != NULL) { delete return_value; }
-	}
 	string str() { 
 		if (return_value) {
 			return string("ReturnStmt") + "(" + return_value->str() + ")"; 
@@ -636,92 +1789,173 @@ public:
 			return string("ReturnStmt") + "(" + "None" + ")";
 		}
 	}
-	llvm::Value *Codegen() {
-		llvm::Value* val;
+#ifndef DECAF_NO_LLVM
+	llvm::Value *Codegen(decafContext &ctx) {
+		llvm::Value* val = NULL;
 		if (return_value) { 
-			val = return_value->Codegen();
-			returnValue = val;
-			Builder.CreateRet(returnValue);
-			returnValue = NULL;
+			val = return_value->Codegen(ctx);
+			ctx.returnValue = val;
+			ctx.Builder.CreateRet(ctx.returnValue);
+			ctx.returnValue = NULL;
+		} else {
+			ctx.return_default();
 		}
 		return val;
 	}
+#endif
+	int Lower(vmLowering &vm) {
+		if (return_value && vm.returnType == TypeVoid) {
+			throw runtime_error("return value in a void method");
+		} else if (return_value) {
+			int reg = return_value->Lower(vm);
+			vm.expect(vm.returnType, "return value");
+			vm.emit(VmReturn, reg);
+		} else if (vm.returnType == TypeVoid) {
+			vm.emit(VmReturnVoid);
+		} else {
+			// the value a method returns when it runs off its end
+			int reg = vm.temp();
+			vm.emit(VmConst, reg, vm.returnType == TypeBool ? 1 : 0);
+			vm.emit(VmReturn, reg);
+		}
+		return -1;
+	}
+	decafAST *Optimize(astOptimizer &opt) {
+		if (return_value) { return_value = opt.expr(return_value); }
+		return this;
+	}
+	void Resolve(decafResolver &res) {
+		if (return_value) { return_value->Resolve(res); }
+	}
 };
 
 class VarDefAST : public decafAST {
 	bool param;
-	string name;
-	string type;
+	llvm::StringRef name;
+	symbol_id sym;
+	decafType type;
+	int slot;		// among the method's locals, set by Resolve()
 public:
-	VarDefAST(bool param, string name, string type) : param(param), name(name), type(type) {}
-	string getName() { return name; }
-	string getVarType() { return type; }
+	VarDefAST(bool param, symbol_id sym, decafType type) : param(param), name(symbol_text(sym)), sym(sym), type(type) {}
+	llvm::StringRef getName() { return name; }
+	int getSlot() { return slot; }
+	decafType getVarType() { return type; }
 	string str() {
 		if (name.compare("extern") != 0) {
-			return string("VarDef") + "(" + name + "," + type + ")";
+			return string("VarDef") + "(" + name.str() + "," + typeNames[type] + ")";
 		} else {
-			return string("VarDef") + "(" + type + ")"; 
+			return string("VarDef") + "(" + typeNames[type] + ")"; 
 		}
 	}
-	llvm::Value *Codegen() {
+#ifndef DECAF_NO_LLVM
+	llvm::Value *Codegen(decafContext &ctx) {
 		if (name.empty()) { return NULL; }
 
-		llvm::Type *llvm_type = getType(type);
+		llvm::Type *llvm_type = ctx.getType(type);
 		llvm::AllocaInst *p_alloc = NULL;
 
 		if (param == false) {
-			p_alloc = Builder.CreateAlloca(llvm_type, NULL, name);
-			(symtbl.front())[name] = p_alloc;
+			p_alloc = ctx.local(llvm_type, name);
+			// Decaf variables start out as zero (false)
+			ctx.store(llvm::Constant::getNullValue(llvm_type), p_alloc);
+			ctx.locals[slot] = p_alloc;
 		}
 
 		return (llvm::Value*)p_alloc;
 	}
+#endif
+	int Lower(vmLowering &vm) {
+		// parameters get their registers from MethodAST
+		if (param || name.empty()) { return -1; }
+		int reg = vm.temp();
+		vm.emit(VmConst, reg, 0);
+		vm.slots[slot] = vm_ref(RefLocal, reg, type);
+		return reg;
+	}
+	decafAST *Optimize(astOptimizer &opt) {
+		if (!name.empty()) { opt.names.insert(sym, ast_name(NameLocal, type)); }
+		return this;
+	}
+	// parameters too, which MethodAST resolves first
+	void Resolve(decafResolver &res) {
+		if (name.empty()) { return; }
+		slot = res.locals++;
+		res.names.insert(sym, decl_ref(DeclLocal, slot));
+	}
 };
 
 class FieldDeclAST : public decafAST {
-	string name;
-	string type;
-	string size;
+	llvm::StringRef name;
+	symbol_id sym;
+	decafType type;
+	llvm::StringRef size;
 	ConstantAST* constant;
+	int slot;		// among the globals, set by Resolve()
 	
 public:
-	FieldDeclAST(string name, string type, string size, ConstantAST* constant) : name(name), type(type), size(size), constant(constant) {}
+	FieldDeclAST(symbol_id sym, decafType type, llvm::StringRef size, ConstantAST* constant) : name(symbol_text(sym)), sym(sym), type(type), size(size), constant(constant) {}
 	string str() { 
 		if (constant) {
-			return string("AssignGlobalVar") + "(" + name + "," + type + "," + getString(constant) + ")";
+			return string("AssignGlobalVar") + "(" + name.str() + "," + typeNames[type] + "," + getString(constant) + ")";
 		} else {
-			return string("FieldDecl") + "(" + name + "," + type + "," + size + ")";
+			return string("FieldDecl") + "(" + name.str() + "," + typeNames[type] + "," + size.str() + ")";
 		}
 	}
-	llvm::Value *Codegen() {
+#ifndef DECAF_NO_LLVM
+	llvm::Value *Codegen(decafContext &ctx) {
 		llvm::Constant* Initializer;
-		llvm::Type* llvm_type = getType(type);
+		llvm::Type* llvm_type = ctx.getType(type);
 		llvm::GlobalVariable *GV;
 
 		if (constant) {	//globalvar
-			Initializer = (llvm::Constant*)constant->Codegen();
+			Initializer = (llvm::Constant*)constant->Codegen(ctx);
 		} else {
 			if (llvm_type->isIntegerTy(32)) {
-				Initializer = Builder.getInt32(0);
+				Initializer = ctx.Builder.getInt32(0);
 			} else if (llvm_type->isVoidTy()) {
 				Initializer = NULL;
 			} else if (llvm_type->isIntegerTy(1)) {
-				Initializer = Builder.getInt1(0);
+				Initializer = ctx.Builder.getInt1(0);
 			}
 		}
 		
 		if (constant || size == "Scalar" ) {
-			GV = new llvm::GlobalVariable(*TheModule, llvm_type, false, llvm::GlobalValue::InternalLinkage, Initializer, name);
+			GV = new llvm::GlobalVariable(*ctx.TheModule, llvm_type, false, llvm::GlobalValue::InternalLinkage, Initializer, name);
     	} else {
-			llvm::ArrayType *arrayi32 = llvm::ArrayType::get(llvm_type, 10);  
-			llvm::Constant *zeroInit = llvm::Constant::getNullValue(arrayi32);
-			GV = new llvm::GlobalVariable(*TheModule, arrayi32, false, llvm::GlobalValue::ExternalLinkage, zeroInit, name);
+			// size is Array(N)
+			llvm::ArrayType *array_type = llvm::ArrayType::get(llvm_type, strtoint(size.substr(6, size.size() - 7).str()));
+			llvm::Constant *zeroInit = llvm::Constant::getNullValue(array_type);
+			GV = new llvm::GlobalVariable(*ctx.TheModule, array_type, false, llvm::GlobalValue::ExternalLinkage, zeroInit, name);
+			// room for aligned 256-bit vector loads
+			GV->setAlignment(llvm::MaybeAlign(32));
 		}
 
-		(symtbl.front())[name] = (llvm::Value*) GV;
+		ctx.globals[slot] = GV;
 
 		return GV;
 	}
+#endif
+	int Lower(vmLowering &vm) {
+		if (constant || size == "Scalar") {
+			vm.program.globals.push_back(constant ? constant->value() : 0);
+			vm.globals[slot] = vm_ref(RefGlobal, vm.program.globals.size() - 1, type);
+		} else {
+			// size is Array(N)
+			vm_array array = { vm.program.array_words, strtoint(size.substr(6, size.size() - 7).str()) };
+			vm.program.arrays.push_back(array);
+			vm.program.array_words += array.size;
+			vm.globals[slot] = vm_ref(RefArray, vm.program.arrays.size() - 1, type);
+		}
+		return -1;
+	}
+	decafAST *Optimize(astOptimizer &opt) {
+		opt.names.insert(sym, ast_name(constant || size == "Scalar" ? NameGlobal : NameArray, type));
+		return this;
+	}
+	void Resolve(decafResolver &res) {
+		slot = res.globals++;
+		res.names.insert(sym, decl_ref(constant || size == "Scalar" ? DeclGlobal : DeclArray, slot));
+	}
 };
 
 class MethodBlockAST : public decafAST {
@@ -729,151 +1963,229 @@ class MethodBlockAST : public decafAST {
 	decafStmtList* statement_list;
 public:
 	MethodBlockAST(decafStmtList* var_decl_list, decafStmtList* statement_list) : var_decl_list(var_decl_list), statement_list(statement_list) {}
-	~MethodBlockAST() {
-		if (var_decl_list != NULL) { delete var_decl_list; }
-		if (statement_list != NULL) { delete statement_list; }
-	}
 	string str() { return string("MethodBlock") + "(" + getString(var_decl_list) + "," + getString(statement_list) + ")"; }
-	llvm::Value *Codegen() {
-		symtbl.push_front(symbol_table());
-
-		llvm::BasicBlock* CurBB = Builder.GetInsertBlock();
+#ifndef DECAF_NO_LLVM
+	llvm::Value *Codegen(decafContext &ctx) {
+		llvm::BasicBlock* CurBB = ctx.Builder.GetInsertBlock();
     	llvm::Function* p_func = CurBB->getParent();
-		llvm::StringRef func_name = p_func->getName();
     	llvm::AllocaInst* p_alloc;
 
-		string arg_name;
+		// the parameters are the first locals, in order
 		for (llvm::Function::arg_iterator it = p_func->arg_begin(); it != p_func->arg_end(); it++) {
-			arg_name = (*it).getName();
-			p_alloc = Builder.CreateAlloca((*it).getType() , NULL, (*it).getName());
-			Builder.CreateStore(&(*it), p_alloc);
-			(symtbl.front())[arg_name] = (llvm::Value*)p_alloc;
+			p_alloc = ctx.local((*it).getType(), (*it).getName());
+			ctx.store(&(*it), p_alloc);
+			ctx.locals[it->getArgNo()] = p_alloc;
 		}
 
-		if (var_decl_list != NULL) { var_decl_list->Codegen(); }
-		if (statement_list != NULL) { statement_list->Codegen(); }
+		if (var_decl_list != NULL) { var_decl_list->Codegen(ctx); }
+		if (statement_list != NULL) { statement_list->codegenStatements(ctx); }
 
-		symbol_table sym_table = symtbl.front();
-		symtbl.pop_front();
 		return NULL;
 	}
+#endif
+	int Lower(vmLowering &vm) {
+		if (var_decl_list != NULL) { var_decl_list->Lower(vm); }
+		if (statement_list != NULL) { statement_list->lowerStatements(vm); }
+		return -1;
+	}
+	decafAST *Optimize(astOptimizer &opt) {
+		opt.forget();
+		opt.names.push_scope();
+		if (var_decl_list != NULL) { var_decl_list->Optimize(opt); }
+		if (statement_list != NULL) { statement_list->Optimize(opt); }
+		opt.names.pop_scope();
+		opt.forget();
+		return this;
+	}
+	void Resolve(decafResolver &res) {
+		res.names.push_scope();
+		if (var_decl_list != NULL) { var_decl_list->Resolve(res); }
+		if (statement_list != NULL) { statement_list->Resolve(res); }
+		res.names.pop_scope();
+	}
 };
 
 class MethodAST : public decafAST {
-	string name;
-	string type;
+	llvm::StringRef name;
+	symbol_id sym;
+	decafType type;
 	decafStmtList* param_list;
 	MethodBlockAST* block;
+	int index;		// among the functions, set by declare()
+	int nlocals;		// parameters and variables, set by Resolve()
 public:
-	MethodAST(string name, string type, decafStmtList* param_list, MethodBlockAST* block)
-		: name(name), type(type), param_list(param_list), block(block) {}
-	~MethodAST() {
-		if (param_list != NULL) { delete param_list; }
-		if (block != NULL) { delete block; }
-	}
-	string str() { return string("Method") + "(" + name + "," + type + "," + getString(param_list) + "," + getString(block) + ")"; }	// param list printed the wrong way
-	llvm::Function *func() {
+	MethodAST(symbol_id sym, decafType type, decafStmtList* param_list, MethodBlockAST* block)
+		: name(symbol_text(sym)), sym(sym), type(type), param_list(param_list), block(block) {}
+	string str() { return string("Method") + "(" + name.str() + "," + typeNames[type] + "," + getString(param_list) + "," + getString(block) + ")"; }	// param list printed the wrong way
+#ifndef DECAF_NO_LLVM
+	llvm::Function *func(decafContext &ctx) {
 		llvm::Function *p_func;
-		list<decafAST*> stmnts;
 		llvm::Type *return_type; 
-		return_type = getType(type);
+		return_type = ctx.getType(type);
 
 		assert(return_type != NULL);
 
-		if (param_list != NULL) {
-			stmnts = param_list->getList();
-			param_list->Codegen();
-		}
-
-		vector<string> arg_names;
+		vector<llvm::StringRef> arg_names;
 		vector<llvm::Type*> arg_types;
-		for (list<decafAST*>::iterator it = stmnts.begin(); it != stmnts.end(); it++) {
-			VarDefAST* varDef = (VarDefAST*)(*it);
-      		llvm::Type* vdtype = getType(varDef->getVarType());
-      		string vdname = varDef->getName(); 
-			arg_types.push_back(vdtype);  
-      		arg_names.push_back(vdname);
+		if (param_list != NULL) {
+			param_list->Codegen(ctx);
+			for (decafAST *param : *param_list) {
+				VarDefAST* varDef = (VarDefAST*)param;
+				arg_types.push_back(ctx.getType(varDef->getVarType()));
+				arg_names.push_back(varDef->getName());
+			}
 		}
 
-		p_func = llvm::Function::Create(llvm::FunctionType::get(return_type, arg_types, false), llvm::Function::ExternalLinkage, name, TheModule);
+		p_func = llvm::Function::Create(llvm::FunctionType::get(return_type, arg_types, false), llvm::Function::ExternalLinkage, name, ctx.TheModule);
 
 		unsigned int i = 0;
 		for (auto &Arg : p_func->args()) {
 			Arg.setName(arg_names[i++]);
 		}
 
-		(symtbl.front())[name] = (llvm::Value*)p_func;
+		ctx.functions[index] = p_func;
 		return p_func;
 	}
 
-	llvm::Value *Codegen() {
-		llvm::Function *p_func = (llvm::Function*)access_symtbl(name);
-		list<decafAST*> stmnts;
-		llvm::Type *return_type = getType(type);
+	llvm::Value *Codegen(decafContext &ctx) {
+		llvm::Function *p_func = ctx.functions[index];
 
 		if (param_list != NULL) {
-			stmnts = param_list->getList();
-			param_list->Codegen();
+			param_list->Codegen(ctx);
 		}
 
-		llvm::BasicBlock *BB = llvm::BasicBlock::Create(TheContext, "entry", p_func);
-		Builder.SetInsertPoint(BB);
+		ctx.start_function(nlocals);
+		llvm::BasicBlock *BB = llvm::BasicBlock::Create(ctx.TheContext, "entry", p_func);
+		ctx.seal(BB);
+		ctx.Builder.SetInsertPoint(BB);
 
 		if (block) {
-			block->Codegen(); 
+			block->Codegen(ctx); 
 		}
 
-		if (returnValue == NULL) {
-			if(return_type->isVoidTy()) { 
-				Builder.CreateRet(NULL);
-			} else {
-				if (return_type->isIntegerTy(32)) { 
-					returnValue = Builder.getInt32(0); 
-				} else { 
-					returnValue = Builder.getInt1(1) ; 
-				} 
-				Builder.CreateRet(returnValue);
-				returnValue = NULL;
-			}
+		// running off the end returns the default value
+		if (!ctx.terminated()) {
+			ctx.return_default();
 		}
+		ctx.finish_function();
 
 		verifyFunction(*p_func);
 		return (llvm::Value*)p_func;
 	}
+#endif
+
+	// make the method callable before any bodies are lowered
+	void declare(vmLowering &vm) {
+		vm_method method = { name.str(), -1, param_list != NULL ? param_list->size() : 0, 0, type != TypeVoid };
+		vm.program.methods.push_back(method);
+		vm.functions[index] = vm_ref(RefMethod, vm.program.methods.size() - 1, type);
+		if (name == "main") { vm.program.main = vm.program.methods.size() - 1; }
+	}
+	int Lower(vmLowering &vm) {
+		int id = vm.functions[index].index;
+		vm.program.methods[id].entry = vm.label();
+		vm.returnType = type;
+		vm.next = vm.nregs = 0;
+		vm.slots.assign(nlocals, vm_ref());
+		if (param_list != NULL) {
+			for (decafAST *param : *param_list) {
+				VarDefAST *varDef = (VarDefAST*)param;
+				vm.slots[varDef->getSlot()] = vm_ref(RefLocal, vm.temp(), varDef->getVarType());
+			}
+		}
+		if (block) {
+			block->Lower(vm);
+		}
+		// running off the end returns as MethodAST::Codegen does
+		ReturnStmtAST(NULL).Lower(vm);
+		vm.program.methods[id].nregs = vm.nregs;
+		return -1;
+	}
+
+	void declare(astOptimizer &opt) { opt.names.insert(sym, ast_name(NameMethod, type)); }
+	decafAST *Optimize(astOptimizer &opt) {
+		opt.names.push_scope();
+		if (param_list != NULL) { param_list->Optimize(opt); }
+		if (block) { block->Optimize(opt); }
+		opt.names.pop_scope();
+		return this;
+	}
+
+	// number the method so calls before its body can be bound
+	void declare(decafResolver &res) { index = res.define_function(sym, param_list != NULL ? param_list->size() : 0); }
+	void Resolve(decafResolver &res) {
+		res.locals = 0;
+		res.names.push_scope();
+		if (param_list != NULL) { param_list->Resolve(res); }
+		if (block) { block->Resolve(res); }
+		res.names.pop_scope();
+		nlocals = res.locals;
+	}
 };
 
 
 class PackageAST : public decafAST {
-	string Name;
+	llvm::StringRef Name;
 	decafStmtList *FieldDeclList;
 	decafStmtList *MethodDeclList;
 public:
-	PackageAST(string name, decafStmtList *fieldlist, decafStmtList *methodlist) 
-		: Name(name), FieldDeclList(fieldlist), MethodDeclList(methodlist) {}
-	~PackageAST() { 
-		if (FieldDeclList != NULL) { delete FieldDeclList; }
-		if (MethodDeclList != NULL) { delete MethodDeclList; }
-	}
+	PackageAST(symbol_id sym, decafStmtList *fieldlist, decafStmtList *methodlist) 
+		: Name(symbol_text(sym)), FieldDeclList(fieldlist), MethodDeclList(methodlist) {}
 	string str() { 
-		return string("Package") + "(" + Name + "," + getString(FieldDeclList) + "," + getString(MethodDeclList) + ")";
+		return string("Package") + "(" + Name.str() + "," + getString(FieldDeclList) + "," + getString(MethodDeclList) + ")";
 	}
-	llvm::Value *Codegen() { 
+#ifndef DECAF_NO_LLVM
+	llvm::Value *Codegen(decafContext &ctx) { 
 		llvm::Value *val = NULL;
-		TheModule->setModuleIdentifier(llvm::StringRef(Name)); 
+		ctx.TheModule->setModuleIdentifier(llvm::StringRef(Name)); 
 		if (NULL != FieldDeclList) {
-			val = FieldDeclList->Codegen();
+			val = FieldDeclList->Codegen(ctx);
 		}
 		if (NULL != MethodDeclList) {
-			list<decafAST *> stmts = MethodDeclList->getList();
-			for(list<decafAST*>::iterator it = stmts.begin(); it != stmts.end(); it++){
-				MethodAST* method = (MethodAST*)(*it);
-				method->func();
+			for (decafAST *method : *MethodDeclList) {
+				((MethodAST*)method)->func(ctx);
 			}
-			val = MethodDeclList->Codegen();
+			val = MethodDeclList->Codegen(ctx);
 		} 
 		// Q: should we enter the class name into the symbol table?
 		return val; 
 	}
+#endif
+	int Lower(vmLowering &vm) {
+		if (NULL != FieldDeclList) {
+			FieldDeclList->Lower(vm);
+		}
+		if (NULL != MethodDeclList) {
+			for (decafAST *method : *MethodDeclList) {
+				((MethodAST*)method)->declare(vm);
+			}
+			MethodDeclList->Lower(vm);
+		}
+		return -1;
+	}
+	decafAST *Optimize(astOptimizer &opt) {
+		if (NULL != FieldDeclList) {
+			FieldDeclList->Optimize(opt);
+		}
+		if (NULL != MethodDeclList) {
+			for (decafAST *method : *MethodDeclList) {
+				((MethodAST*)method)->declare(opt);
+			}
+			MethodDeclList->Optimize(opt);
+		}
+		return this;
+	}
+	void Resolve(decafResolver &res) {
+		if (NULL != FieldDeclList) {
+			FieldDeclList->Resolve(res);
+		}
+		if (NULL != MethodDeclList) {
+			for (decafAST *method : *MethodDeclList) {
+				((MethodAST*)method)->declare(res);
+			}
+			MethodDeclList->Resolve(res);
+		}
+	}
 };
 
 /// ProgramAST - the decaf program
@@ -882,96 +2194,288 @@ class ProgramAST : public decafAST {
 	PackageAST *PackageDef;
 public:
 	ProgramAST(decafStmtList *externs, PackageAST *c) : ExternList(externs), PackageDef(c) {}
-	~ProgramAST() { 
-		if (ExternList != NULL) { delete ExternList; } 
-		if (PackageDef != NULL) { delete PackageDef; }
-	}
 	string str() { return string("Program") + "(" + getString(ExternList) + "," + getString(PackageDef) + ")"; }
-	llvm::Value *Codegen() { 
+#ifndef DECAF_NO_LLVM
+	llvm::Value *Codegen(decafContext &ctx) { 
 		llvm::Value *val = NULL;
 		if (NULL != ExternList) {
-			val = ExternList->Codegen();
+			val = ExternList->Codegen(ctx);
 		}
 		if (NULL != PackageDef) {
-			val = PackageDef->Codegen();
+			val = PackageDef->Codegen(ctx);
 		} else {
 			throw runtime_error("no package definition in decaf program");
 		}
 		return val; 
 	}
+#endif
+	int Lower(vmLowering &vm) {
+		if (NULL != ExternList) {
+			ExternList->Lower(vm);
+		}
+		if (NULL == PackageDef) {
+			throw runtime_error("no package definition in decaf program");
+		}
+		return PackageDef->Lower(vm);
+	}
+	decafAST *Optimize(astOptimizer &opt) {
+		if (NULL != ExternList) {
+			ExternList->Optimize(opt);
+		}
+		if (NULL != PackageDef) {
+			PackageDef->Optimize(opt);
+		}
+		return this;
+	}
+	void Resolve(decafResolver &res) {
+		if (NULL != ExternList) {
+			ExternList->Resolve(res);
+		}
+		if (NULL != PackageDef) {
+			PackageDef->Resolve(res);
+		}
+	}
 };
 
 
 class BreakStmtAST : public decafAST {
 	string str() { return string("BreakStmt"); }
-	llvm::Value *Codegen() {
-		llvm::BasicBlock* BreakBB = (llvm::BasicBlock*)(access_symtbl("0_loopend")); 
-		if (BreakBB != NULL) {
-			Builder.CreateBr(BreakBB);
-		}  
+#ifndef DECAF_NO_LLVM
+	llvm::Value *Codegen(decafContext &ctx) {
+		ctx.Builder.CreateBr(ctx.loops.back().second);
 		return NULL;
 	}
+#endif
+	int Lower(vmLowering &vm) {
+		if (vm.loops.empty()) { throw runtime_error("break outside a loop"); }
+		vm.loops.back().breaks.push_back(vm.emit(VmJump));
+		return -1;
+	}
+	void Resolve(decafResolver &res) {
+		if (res.loops == 0) { throw runtime_error("break outside a loop"); }
+	}
 };
 
 class ContinueStmtAST : public decafAST {
 	string str() { return string("ContinueStmt"); }
-	llvm::Value *Codegen() {
-		llvm::BasicBlock* ContinueBB = (llvm::BasicBlock*)(access_symtbl("0_loopstart")); 
-		if (ContinueBB != NULL) {
-			Builder.CreateBr(ContinueBB);
-		}
+#ifndef DECAF_NO_LLVM
+	llvm::Value *Codegen(decafContext &ctx) {
+		ctx.Builder.CreateBr(ctx.loops.back().first);
 		return NULL;
 	}
+#endif
+	int Lower(vmLowering &vm) {
+		if (vm.loops.empty()) { throw runtime_error("continue outside a loop"); }
+		vm.loops.back().continues.push_back(vm.emit(VmJump));
+		return -1;
+	}
+	void Resolve(decafResolver &res) {
+		if (res.loops == 0) { throw runtime_error("continue outside a loop"); }
+	}
 };
 
 class IdListAST : public decafAST {
 public:
-	vector<string> vec;
-	IdListAST(string name) {
-		vec.push_back(name);
+	arena_vector<symbol_id, 4> vec;
+	IdListAST(symbol_id sym) {
+		vec.push_back(sym);
 	}
-	~IdListAST() {}
-	string str() { return *(vec.begin()); }
-	llvm::Value *Codegen() { return NULL; }
+	string str() { return symbols.name(vec.front()); }
+#ifndef DECAF_NO_LLVM
+	llvm::Value *Codegen(decafContext &ctx) { return NULL; }
+#endif
+	int Lower(vmLowering &vm) { return -1; }
 };
 
 class ExternFunctionAST : public decafAST {
-	string name;
-	string return_type;
+	llvm::StringRef name;
+	symbol_id sym;
+	decafType return_type;
 	decafStmtList* type_list;
+	int index;		// among the functions, set by Resolve()
 public:
-	ExternFunctionAST(string name, string return_type, decafStmtList* type_list) 
-		: name(name), return_type(return_type), type_list(type_list) {}
-	~ExternFunctionAST() {
-		if (type_list != NULL) { delete type_list; }
-	}
-	string str() { return string("ExternFunction") + "(" + name + "," + return_type + "," + getString(type_list) + ")"; }
-	llvm::Value *Codegen() {
-		llvm::Type *ret_type = getType(return_type);
+	ExternFunctionAST(symbol_id sym, decafType return_type, decafStmtList* type_list) 
+		: name(symbol_text(sym)), sym(sym), return_type(return_type), type_list(type_list) {}
+	string str() { return string("ExternFunction") + "(" + name.str() + "," + typeNames[return_type] + "," + getString(type_list) + ")"; }
+#ifndef DECAF_NO_LLVM
+	llvm::Value *Codegen(decafContext &ctx) {
+		llvm::Type *ret_type = ctx.getType(return_type);
 		std::vector<llvm::Type*> args;
 
 
 		if (type_list != NULL) {
-			list<decafAST*> stmts = type_list->getList();
 			llvm::Type* retType;
 
-			for (list<decafAST*>::iterator it = stmts.begin(); it != stmts.end(); it++) {
-				string type = ((VarDefAST*)(*it))->getVarType();
-				if (type.empty()) { 
+			for (decafAST *param : *type_list) {
+				decafType type = ((VarDefAST*)param)->getVarType();
+				if (type == TypeNone) { 
 					args.clear(); 
 					break; 
 				} else { 
-					retType = getType(type);
+					retType = ctx.getType(type);
 				}
 				args.push_back(retType);
 			}
 		}
 
-		llvm::Function *p_func = llvm::Function::Create(llvm::FunctionType::get(ret_type, args, false), llvm::Function::ExternalLinkage, name, TheModule);
+		llvm::Function *p_func = llvm::Function::Create(llvm::FunctionType::get(ret_type, args, false), llvm::Function::ExternalLinkage, name, ctx.TheModule);
 		verifyFunction(*p_func);
 		llvm::Value *val = (llvm::Value*)p_func;
 
-		(symtbl.front())[name] = val;
+		ctx.functions[index] = p_func;
 		return val;
 	}
-};
\ No newline at end of file
+#endif
+	int Lower(vmLowering &vm) {
+		// the vm has the Decaf stdlib built in, and nothing else
+		decafVmRef kind = RefExtern;
+		if (name == "print_int") { kind = RefPrintInt; }
+		else if (name == "print_string") { kind = RefPrintString; }
+		else if (name == "read_int") { kind = RefReadInt; }
+		vm.functions[index] = vm_ref(kind, 0, return_type);
+		return -1;
+	}
+	decafAST *Optimize(astOptimizer &opt) {
+		opt.names.insert(sym, ast_name(NameMethod, return_type));
+		return this;
+	}
+	void Resolve(decafResolver &res) {
+		// an empty list is one TypeNone entry, as Codegen reads it
+		int nparams = 0;
+		if (type_list != NULL) {
+			for (decafAST *param : *type_list) {
+				if (((VarDefAST*)param)->getVarType() != TypeNone) { nparams++; }
+			}
+		}
+		index = res.define_function(sym, nparams);
+	}
+};
+#ifndef DECAF_NO_LLVM
+/// prune_unreachable - delete the blocks control can never reach: code
+/// after a return, break or continue, arms and loop bodies behind a
+/// constant condition, and joins every path into returns before.  They
+/// are generated, and verified, like the rest so errors in them are
+/// still reported, but nothing after decaf_codegen has to see them.
+static void prune_unreachable(llvm::Module &module) {
+	for (llvm::Function &func : module) {
+		if (!func.isDeclaration()) { llvm::removeUnreachableBlocks(func); }
+	}
+}
+#endif
+
+/// decaf_resolve - bind the names in the tree in parser.program with res,
+/// for Codegen() or Lower()
+static void decaf_resolve(decaf_parser &parser, decafResolver &res) {
+	res.names.push_scope();
+	parser.program->Resolve(res);
+}
+
+#ifndef DECAF_NO_LLVM
+/// decaf_codegen - build a module for the tree in parser.program, with
+/// array bounds checks if check_bounds.  With ssa, scalar locals become
+/// SSA values and phis as the code is generated, instead of allocas left
+/// for mem2reg.
+/// Returns NULL and sets error if the program is semantically wrong,
+/// including when the IR it makes does not verify (e.g. a return value
+/// of the wrong type).
+std::unique_ptr<llvm::Module> decaf_codegen(decaf_parser &parser, llvm::LLVMContext &context, string &error, bool check_bounds, bool ssa) {
+	std::unique_ptr<llvm::Module> module(new llvm::Module("Test", context));
+	decafContext ctx(context, module.get());
+	ctx.checkBounds = check_bounds;
+	ctx.ssa = ssa;
+	decafResolver res;
+	try {
+		decaf_resolve(parser, res);
+		ctx.globals.resize(res.globals);
+		ctx.functions.resize(res.functions);
+		parser.program->Codegen(ctx);
+	}
+	catch (std::runtime_error &e) {
+		error = e.what();
+		return NULL;
+	}
+	string problems;
+	llvm::raw_string_ostream out(problems);
+	if (llvm::verifyModule(*module, &out)) {
+		error = out.str().substr(0, problems.find('\n'));
+		return NULL;
+	}
+	prune_unreachable(*module);
+	return module;
+}
+#endif
+
+/// decaf_lower - lower the tree in parser.program to bytecode for vm_run,
+/// resolving it first as decaf_codegen does.
+/// Returns false and sets error if the program is semantically wrong or
+/// calls an extern the vm does not have.
+bool decaf_lower(decaf_parser &parser, vm_program &program, string &error) {
+	vmLowering vm(program);
+	decafResolver res;
+	try {
+		decaf_resolve(parser, res);
+		vm.globals.resize(res.globals);
+		vm.functions.resize(res.functions);
+		parser.program->Lower(vm);
+	}
+	catch (std::runtime_error &e) {
+		error = e.what();
+		return false;
+	}
+	return true;
+}
+
+/// decaf_optimize_ast - run astOptimizer over the tree in parser.program,
+/// adding what it removed to stats
+void decaf_optimize_ast(decaf_parser &parser, ast_opt_stats &stats) {
+	astOptimizer opt(stats);
+	opt.names.push_scope();
+	parser.program->Optimize(opt);
+}
+
+/// decaf_release - add the counts of this thread's interner and arena to
+/// stats (unless it is NULL), then empty both.  Nothing made from the
+/// tree outlives a compilation, so neither grows from one to the next.
+void decaf_release(front_end_stats *stats) {
+	if (stats != NULL) {
+		front_end_stats held;
+		held.lookups = symbols.lookups();
+		held.hits = symbols.hits();
+		held.spellings = symbols.size();
+		held.spelling_bytes = symbols.bytes();
+		held.nodes = ast_arena.nodes;
+		held.bytes_used = ast_arena.bytes_used();
+		held.bytes_reserved = ast_arena.bytes_reserved();
+		held.chunks = ast_arena.num_chunks();
+		stats->add(held);
+	}
+	ast_arena.reset();
+	symbols.reset();
+}
+
+#ifndef DECAF_NO_LLVM
+/// decaf_compile - parse parser.source, optimize the tree unless
+/// optimize_ast is false and generate its module (checking array bounds
+/// if check_bounds, in SSA form if ssa), then release the tree and the
+/// spellings, adding their counts to stats if it is not NULL.
+/// Everything it touches belongs to parser, context or the calling
+/// thread, so compilations on different threads with different
+/// LLVMContexts can run at the same time.
+std::unique_ptr<llvm::Module> decaf_compile(decaf_parser &parser, llvm::LLVMContext &context, string &error, bool optimize_ast, bool check_bounds, bool ssa,
+                                            front_end_stats *stats) {
+	std::unique_ptr<llvm::Module> module;
+	if (decaf_parse(parser) == 0 && parser.program != NULL) {
+		if (optimize_ast) {
+			ast_opt_stats removed;
+			decaf_optimize_ast(parser, removed);
+			if (stats != NULL) { stats->ast.add(removed); }
+		}
+		module = decaf_codegen(parser, context, error, check_bounds, ssa);
+	} else {
+		error = parser.error;
+	}
+	parser.program = NULL;
+	decaf_release(stats);
+	return module;
+}
+#endif
@@ -10,23 +10,51 @@
 #include <algorithm>
 #include "default-defs.h"
 
-int yylex(void);
-int yyerror(char *); 
+// the command line driver; built with -DDECAF_LIBRARY this file is the
+// parser and compiler alone, for libdecaf.a (decaf.h)
+#ifndef DECAF_LIBRARY
+#include "llvm/Support/Format.h"
+#include "llvm/Support/ThreadPool.h"
+#include "optimize.h"
+#include "jit.h"
+#include "tier.h"
+#include "stdlib-link.h"
 
 // print AST?
 bool printAST = false;
+// print compilation statistics (as IR comments) after the module?
+bool printStats = false;
+front_end_stats frontEndStats;	// summed over the files compiled
+// write the module out in-process instead of printing IR to stderr?
+decafEmit emitKind = EmitNone;
+// where to write it, NULL to derive the name from the input
+const char *outputPath = NULL;
+// execute the program in-process (ORC JIT) instead of printing it?
+bool runProgram = false;
+// run it tiered: unoptimized first, hot methods recompiled in the background
+bool tieredRun = false;
+tier_options tierOptions;
+// run it in the bytecode interpreter (vm.h), with no LLVM code generation
+bool vmRun = false;
+// fold, simplify and CSE the AST before code generation or lowering?
+bool astOpt = true;
+// test every array index against the array's size (LLVM paths)?
+bool boundsCheck = false;
+// generate scalar locals straight into SSA form instead of allocas?
+bool ssaCodegen = false;
+// link the stdlib bitcode into modules we write as code or optimize (see
+// wants_stdlib; never for the JIT, which binds decafcomp's own copies)?
+bool linkStdlib = true;
+// -O level, -1 when none was given
+int optLevel = -1;
+// opt-style pass pipeline replacing the -O level's, e.g. "function(sroa)"
+string passPipeline;
+#endif
 
 using namespace std;
 
-// this global variable contains all the generated code
-static llvm::Module *TheModule;
-
-// this is the method used to construct the LLVM intermediate code (IR)
-static llvm::LLVMContext TheContext;
-static llvm::IRBuilder<> Builder(TheContext);
-// the calls to TheContext in the init above and in the
-// following code ensures that we are incrementally generating
-// instructions in the right order
+// the module, IR builder and resolved names live in a decafContext
+// (decafcomp.cc) made for each compilation
 
 // dummy main function
 // WARNING: this is not how you should implement code generation
@@ -55,10 +83,13 @@ static llvm::IRBuilder<> Builder(TheContext);
 %}
 
 %define parse.error verbose
+%define api.pure full
+%param {yyscan_t scanner}
 
 %union{
     class decafAST *ast;
-    std::string *sval;
+    symbol_id sym;
+    decafType tval;
     array_info arrinfo;
  }
 
@@ -68,10 +99,10 @@ static llvm::IRBuilder<> Builder(TheContext);
 %token T_BOOLTYPE T_BREAK T_CONTINUE T_ELSE T_EXTERN T_FALSE T_FOR T_IF T_NULL T_RETURN T_STRINGTYPE
 %token T_PACKAGE T_FUNC T_INTTYPE T_TRUE T_VAR T_VOID T_WHILE
 
-%token <sval> T_ID
-%token <sval> T_CHARCONSTANT
-%token <sval> T_STRINGCONSTANT
-%token <sval> T_INTCONSTANT
+%token <sym> T_ID
+%token <sym> T_CHARCONSTANT
+%token <sym> T_STRINGCONSTANT
+%token <sym> T_INTCONSTANT
 
 %left T_OR
 %left T_AND
@@ -85,157 +116,145 @@ static llvm::IRBuilder<> Builder(TheContext);
 %type <ast> rvalue method_arg method_arg_list method_call expr assign block
 %type <ast> statement_list var_decl var_decl_list identifier_list assign_list
 %type <ast> field_decl field_decl_list method method_block method_list method_type_list 
-%type <ast> break_statement continue_statement extern_def extern_typelist method_arg_list_empty id_type_list
-%type <sval> decaf_type method_type extern_type 
+%type <ast> break_statement continue_statement extern_def extern_typelist extern_type_list method_arg_list_empty id_type_list
+%type <tval> decaf_type method_type extern_type 
 %type <arrinfo> array_type
 
+%code {
+int yylex(YYSTYPE *lvalp, yyscan_t scanner);
+}
+
 %%
 
 start: program
 
 program: extern_list decafpackage
     { 
-        ProgramAST *prog = new ProgramAST((decafStmtList *)$1, (PackageAST *)$2); 
-		if (printAST) {
-			cout << getString(prog) << endl;
-		}
-        try {
-            prog->Codegen();
-        } 
-        catch (std::runtime_error &e) {
-            cout << "semantic error: " << e.what() << endl;
-            //cout << prog->str() << endl; 
-            exit(EXIT_FAILURE);
-        }
-        delete prog;
+        // hand the tree back to decaf_parse; code generation happens
+        // after the parse so the parser itself holds no compiler state
+        yyget_extra(scanner)->program = new ProgramAST((decafStmtList *)$1, (PackageAST *)$2); 
     }
     ;
 
-extern_list: extern_def extern_list { decafStmtList* list; 
-                               if ($2 == NULL) {
+/* lists are left recursive and append with push_back: the parser reduces
+   each element as soon as it is complete, so the parse stack stays shallow
+   no matter how long the list is, and elements still come out in source order */
+extern_list: extern_list extern_def { decafStmtList* list;
+                               if ($1 == NULL) {
                                    list = new decafStmtList();
-                               } else if ($2 != NULL) {
-                                   list = (decafStmtList*)$2;
+                               } else {
+                                   list = (decafStmtList*)$1;
                                }
-                               list->push_front($1);
+                               list->push_back($2);
                                $$ = list;
                                }
-    |        { $$ = NULL; }
+    |        %empty { $$ = NULL; }
     ;
 
-extern_typelist: extern_type T_COMMA extern_typelist { decafStmtList* list = (decafStmtList*)$3;
-                                                       VarDefAST* var = new VarDefAST(true, string("extern"), *$1);
-                                                       list->push_front(var);
-                                                       $$ = list;
-                                                       delete $1; }
-    |            extern_type { decafStmtList* list = new decafStmtList();
-                               VarDefAST* var = new VarDefAST(true, string("extern"), *$1);
-                               list->push_front(var);
-                               $$ = list;
-                               delete $1; }
-    |                        { decafStmtList* list = new decafStmtList();
-                               VarDefAST* varDef = new VarDefAST(true, string("extern"), string("extern"));
-                               list->push_front(varDef);
-                               $$ = list;}
-    ;
-
-extern_def: T_EXTERN T_FUNC T_ID T_LPAREN extern_typelist T_RPAREN method_type T_SEMICOLON { $$ = new ExternFunctionAST(*$3, *$7, (decafStmtList*)$5); 
-                                                                                             delete $3;
-                                                                                             delete $7; }
+extern_type_list: extern_type_list T_COMMA extern_type { decafStmtList* list = (decafStmtList*)$1;
+                                                         VarDefAST* var = new VarDefAST(true, symbols.intern("extern"), $3);
+                                                         list->push_back(var);
+                                                         $$ = list; }
+    |             extern_type { decafStmtList* list = new decafStmtList();
+                                VarDefAST* var = new VarDefAST(true, symbols.intern("extern"), $1);
+                                list->push_back(var);
+                                $$ = list; }
     ;
 
-begin_block: T_LCB { symtbl.push_front(symbol_table()); }
+extern_typelist: extern_type_list { $$ = $1; }
+    |            %empty     { decafStmtList* list = new decafStmtList();
+                               VarDefAST* varDef = new VarDefAST(true, symbols.intern("extern"), TypeNone);
+                               list->push_back(varDef);
+                               $$ = list;}
     ;
 
-end_block: T_RCB { symbol_table st = symtbl.front();
-                   symtbl.pop_front(); }
+extern_def: T_EXTERN T_FUNC T_ID T_LPAREN extern_typelist T_RPAREN method_type T_SEMICOLON { $$ = new ExternFunctionAST($3, $7, (decafStmtList*)$5); }
     ;
 
-decafpackage: T_PACKAGE T_ID begin_block field_decl_list method_list end_block
-    { $$ = new PackageAST(*$2, (decafStmtList*)$4, (decafStmtList*)$5); delete $2; }
+decafpackage: T_PACKAGE T_ID T_LCB field_decl_list method_list T_RCB
+    { $$ = new PackageAST($2, (decafStmtList*)$4, (decafStmtList*)$5); }
     ;
 
-decaf_type: T_INTTYPE { $$ = new string("IntType"); }
-    |       T_BOOLTYPE { $$ = new string("BoolType"); }
+decaf_type: T_INTTYPE { $$ = TypeInt; }
+    |       T_BOOLTYPE { $$ = TypeBool; }
     ;
 
-method_type: T_VOID { $$ = new string("VoidType"); }
+method_type: T_VOID { $$ = TypeVoid; }
     |        decaf_type { $$ = $1; }
     ;
 
-extern_type: T_STRINGTYPE { $$ = new string("StringType"); }
+extern_type: T_STRINGTYPE { $$ = TypeString; }
     |        decaf_type { $$ = $1; }
     ;
 
-bool_constant: T_TRUE { $$ = new ConstantAST(string("BoolExpr"), string("True")); }
-    |          T_FALSE { $$ = new ConstantAST(string("BoolExpr"), string("False")); }
+bool_constant: T_TRUE { $$ = new ConstantAST(ConstBool, "True"); }
+    |          T_FALSE { $$ = new ConstantAST(ConstBool, "False"); }
     ;
 
-method_arg: T_STRINGCONSTANT { $$ = new ConstantAST(string("StringConstant"), *$1); 
-                               delete $1; }
+method_arg: T_STRINGCONSTANT { $$ = new ConstantAST(ConstString, symbol_text($1)); }
     |       expr { $$ = $1; }
     ;
 
-constant: T_INTCONSTANT { $$ = new ConstantAST(string("NumberExpr"), *$1); delete $1; }
-    |     T_CHARCONSTANT { $$ = new ConstantAST(string("NumberExpr"), strtoascii(*$1)); delete $1; }
+constant: T_INTCONSTANT { $$ = new ConstantAST(ConstNumber, symbol_text($1)); }
+    |     T_CHARCONSTANT { $$ = new ConstantAST(ConstNumber, arena_str(strtoascii(symbols.name($1)))); }
     |     bool_constant { $$ = $1; }
     ;
 
-rvalue: T_ID T_LSB expr T_RSB { $$ = new ArrayLocExprAST(*$1, (decafStmtList*) $3); delete $1; }
-    |   T_ID { $$ = new VariableExprAST(*$1); delete $1; }
+rvalue: T_ID T_LSB expr T_RSB { $$ = new ArrayLocExprAST($1, $3); }
+    |   T_ID { $$ = new VariableExprAST($1); }
     ;
 
 /* T_ID T_LPAREN T_RPAREN { $$ = new MethodCallAST(*$1, NULL); } */
-method_call: T_ID T_LPAREN method_arg_list_empty T_RPAREN { $$ = new MethodCallAST(*$1, (decafStmtList*)$3); delete $1; }
+method_call: T_ID T_LPAREN method_arg_list_empty T_RPAREN { $$ = new MethodCallAST($1, (decafStmtList*)$3); }
     ;
 
 
 // method_arg_list? or method_arg_list_empty? as last arg
-method_arg_list: method_arg T_COMMA method_arg_list { decafStmtList* list = (decafStmtList*) $3; 
-                                                      list->push_front($1);
+method_arg_list: method_arg_list T_COMMA method_arg { decafStmtList* list = (decafStmtList*) $1; 
+                                                      list->push_back($3);
                                                       $$ = list; }
     |            method_arg { decafStmtList* list = new decafStmtList();
-                              list->push_front($1);
+                              list->push_back($1);
                               $$ = list; }
     ;
 
 method_arg_list_empty: method_arg_list { $$ = $1; }
-    |                  { $$ = NULL; }
+    |                  %empty { $$ = NULL; }
     ;
 
 /* delete $2 ? */
 expr: rvalue { $$ = $1; }
     | method_call { $$ = $1; }
     | constant { $$ = $1; }
-    | expr T_MULT expr { $$ = new BinaryExprAST(string("T_MULT"), $1, $3); }
-    | expr T_DIV expr { $$ = new BinaryExprAST(string("T_DIV"), $1, $3); }
-    | expr T_MOD expr { $$ = new BinaryExprAST(string("T_MOD"), $1, $3); }
-    | expr T_PLUS expr { $$ = new BinaryExprAST(string("T_PLUS"), $1, $3); }
-    | expr T_MINUS expr { $$ = new BinaryExprAST(string("T_MINUS"), $1, $3); }
-    | expr T_LEFTSHIFT expr { $$ = new BinaryExprAST(string("T_LEFTSHIFT"), $1, $3); }
-    | expr T_RIGHTSHIFT expr { $$ = new BinaryExprAST(string("T_RIGHTSHIFT"), $1, $3); }
-    | expr T_EQ expr { $$ = new BinaryExprAST(string("T_EQ"), $1, $3); }
-    | expr T_NEQ expr { $$ = new BinaryExprAST(string("T_NEQ"), $1, $3); }
-    | expr T_GEQ expr { $$ = new BinaryExprAST(string("T_GEQ"), $1, $3); }
-    | expr T_LEQ expr { $$ = new BinaryExprAST(string("T_LEQ"), $1, $3); }
-    | expr T_GT expr { $$ = new BinaryExprAST(string("T_GT"), $1, $3); }
-    | expr T_LT expr { $$ = new BinaryExprAST(string("T_LT"), $1, $3); }
-    | expr T_AND expr { $$ = new BinaryExprAST(string("T_AND"), $1, $3); }
-    | expr T_OR expr { $$ = new BinaryExprAST(string("T_OR"), $1, $3); }
-    | T_MINUS expr %prec UMINUS { $$ = new UnaryExprAST(string("T_UMINUS"), $2); }
-    | T_NOT expr { $$ = new UnaryExprAST(string("T_NOT"), $2); }
+    | expr T_MULT expr { $$ = new BinaryExprAST(OpMult, $1, $3); }
+    | expr T_DIV expr { $$ = new BinaryExprAST(OpDiv, $1, $3); }
+    | expr T_MOD expr { $$ = new BinaryExprAST(OpMod, $1, $3); }
+    | expr T_PLUS expr { $$ = new BinaryExprAST(OpPlus, $1, $3); }
+    | expr T_MINUS expr { $$ = new BinaryExprAST(OpMinus, $1, $3); }
+    | expr T_LEFTSHIFT expr { $$ = new BinaryExprAST(OpLeftShift, $1, $3); }
+    | expr T_RIGHTSHIFT expr { $$ = new BinaryExprAST(OpRightShift, $1, $3); }
+    | expr T_EQ expr { $$ = new BinaryExprAST(OpEq, $1, $3); }
+    | expr T_NEQ expr { $$ = new BinaryExprAST(OpNeq, $1, $3); }
+    | expr T_GEQ expr { $$ = new BinaryExprAST(OpGeq, $1, $3); }
+    | expr T_LEQ expr { $$ = new BinaryExprAST(OpLeq, $1, $3); }
+    | expr T_GT expr { $$ = new BinaryExprAST(OpGt, $1, $3); }
+    | expr T_LT expr { $$ = new BinaryExprAST(OpLt, $1, $3); }
+    | expr T_AND expr { $$ = new BinaryExprAST(OpAnd, $1, $3); }
+    | expr T_OR expr { $$ = new BinaryExprAST(OpOr, $1, $3); }
+    | T_MINUS expr %prec UMINUS { $$ = new UnaryExprAST(OpUnaryMinus, $2); }
+    | T_NOT expr { $$ = new UnaryExprAST(OpNot, $2); }
     | T_LPAREN expr T_RPAREN { $$ = $2; }
     ;
 
-assign: T_ID T_ASSIGN expr { $$ = new AssignVarAST(*$1, $3); delete $1; }
-    |   T_ID T_LSB expr T_RSB T_ASSIGN expr { $$ = new AssignArrayLocAST(*$1, $3, $6); delete $1; }
+assign: T_ID T_ASSIGN expr { $$ = new AssignVarAST($1, $3); }
+    |   T_ID T_LSB expr T_RSB T_ASSIGN expr { $$ = new AssignArrayLocAST($1, $3, $6); }
     ;
 
-assign_list: assign T_COMMA assign_list { decafStmtList* list = (decafStmtList*)$3;
-                                  list->push_front($1);
+assign_list: assign_list T_COMMA assign { decafStmtList* list = (decafStmtList*)$1;
+                                  list->push_back($3);
                                   $$ = list; }
     |        assign { decafStmtList* list = new decafStmtList();
-                      list->push_front($1);
+                      list->push_back($1);
                       $$ = list; }
     ;
 
@@ -245,30 +264,28 @@ break_statement: T_BREAK T_SEMICOLON { $$ = new BreakStmtAST(); }
 continue_statement: T_CONTINUE T_SEMICOLON { $$ = new ContinueStmtAST(); }
     ;
 
-identifier_list: T_ID T_COMMA identifier_list { IdListAST* list = (IdListAST*)$3;
-                                                list->vec.push_back(*$1);
-                                                $$ = list;
-                                                delete $1; }
-    |            T_ID                         { $$ = new IdListAST(*$1);
-                                                delete $1; }
+identifier_list: identifier_list T_COMMA T_ID { IdListAST* list = (IdListAST*)$1;
+                                                list->vec.push_back($3);
+                                                $$ = list; }
+    |            T_ID                         { $$ = new IdListAST($1); }
     ;
 
-var_decl_list: var_decl var_decl_list { decafStmtList* list;
-                                        if ($2) {
-                                            list = (decafStmtList*)$2;
+var_decl_list: var_decl_list var_decl { decafStmtList* list;
+                                        if ($1) {
+                                            list = (decafStmtList*)$1;
                                         } else {
                                             list = new decafStmtList();
                                         }
-                                        list->push_front($1);
+                                        list->push_back($2);
                                         $$ = list; }
-    |          { $$ = NULL; }
+    |          %empty { $$ = NULL; }
     ;
 
 var_decl: T_VAR identifier_list decaf_type T_SEMICOLON { IdListAST* list = (IdListAST*)$2;
                                                          decafStmtList* list2 = new decafStmtList();
-                                                         for (vector<string>::iterator it = (*list).vec.begin(); it != (*list).vec.end(); ++it) {
-                                                             VarDefAST* var = new VarDefAST(false, (*it), *$3);
-                                                             list2->push_front(var);
+                                                         for (auto it = (*list).vec.begin(); it != (*list).vec.end(); ++it) {
+                                                             VarDefAST* var = new VarDefAST(false, (*it), $3);
+                                                             list2->push_back(var);
                                                          }
                                                          $$ = list2; }
     ;
@@ -281,50 +298,43 @@ array_type: T_LSB T_INTCONSTANT T_RSB decaf_type { array_info info;
 ;
 
 
-field_decl_list: field_decl field_decl_list { decafStmtList* list;
-                                              if ($2) {
-                                                  list = (decafStmtList*)$2;
+field_decl_list: field_decl_list field_decl { decafStmtList* list;
+                                              if ($1) {
+                                                  list = (decafStmtList*)$1;
                                               } else {
                                                   list = new decafStmtList();
                                               }
-                                              list->push_front($1);
+                                              list->push_back($2);
                                               $$ = list; }
-    |            { $$ = NULL; }
+    |            %empty { $$ = NULL; }
     ;
 
 field_decl: T_VAR identifier_list decaf_type T_SEMICOLON { IdListAST* list = (IdListAST*)$2; 
                                                            decafStmtList* list2 = new decafStmtList();
-                                                           for (vector<string>::iterator it = (*list).vec.begin(); it != (*list).vec.end(); ++it) {
-                                                               FieldDeclAST* field = new FieldDeclAST((*it), *$3, "Scalar", NULL);
-                                                               list2->push_front(field); 
+                                                           for (auto it = (*list).vec.begin(); it != (*list).vec.end(); ++it) {
+                                                               FieldDeclAST* field = new FieldDeclAST((*it), $3, "Scalar", NULL);
+                                                               list2->push_back(field); 
                                                            }
-                                                           $$ = list2;
-                                                           delete $2;
-                                                           delete $3; }
+                                                           $$ = list2; }
     |       T_VAR identifier_list array_type T_SEMICOLON { IdListAST* list = (IdListAST*)$2; 
                                                            decafStmtList* list2 = new decafStmtList();
 
-                                                           string field_type = *($3.type);
-                                                           string field_size = string("Array(") + *($3.size) + ")";
+                                                           decafType field_type = $3.type;
+                                                           llvm::StringRef field_size = arena_str(string("Array(") + symbols.name($3.size) + ")");
 
-                                                           for (vector<string>::iterator it = (*list).vec.begin(); it != (*list).vec.end(); ++it) {
+                                                           for (auto it = (*list).vec.begin(); it != (*list).vec.end(); ++it) {
                                                                //FieldDeclAST* field = new FieldDeclAST((*it), *$6, "Array(" + string(*$4) + ")", NULL);
                                                                FieldDeclAST* field = new FieldDeclAST((*it), field_type, field_size, NULL);
-                                                               list2->push_front(field); 
+                                                               list2->push_back(field); 
                                                            }
-                                                           $$ = list2;
-                                                           delete $2; 
-                                                           delete $3.type;
-                                                           delete $3.size; }
+                                                           $$ = list2; }
     |       T_VAR identifier_list decaf_type T_ASSIGN constant T_SEMICOLON { IdListAST* list = (IdListAST*)$2; 
                                                                              decafStmtList* list2 = new decafStmtList();
-                                                                             for (vector<string>::iterator it = (*list).vec.begin(); it != (*list).vec.end(); ++it) {
-                                                                                 FieldDeclAST* field = new FieldDeclAST((*it), *$3, "", (ConstantAST*)$5);
-                                                                                 list2->push_front(field); 
+                                                                             for (auto it = (*list).vec.begin(); it != (*list).vec.end(); ++it) {
+                                                                                 FieldDeclAST* field = new FieldDeclAST((*it), $3, "", (ConstantAST*)$5);
+                                                                                 list2->push_back(field); 
                                                                              }
-                                                                             $$ = list2;
-                                                                             delete $2;
-                                                                             delete $3; }
+                                                                             $$ = list2; }
     ;
 
 
@@ -332,56 +342,46 @@ method_block: T_LCB var_decl_list statement_list T_RCB { $$ = new MethodBlockAST
     ;
 
 
-method_type_list:   { $$ = NULL; }
+method_type_list:   %empty { $$ = NULL; }
     |               id_type_list { $$ = $1; }
     ;
 
-id_type_list:   T_ID decaf_type T_COMMA id_type_list { VarDefAST* varDef = new VarDefAST(true, *$1, *$2);
-                                                       ((decafStmtList*)$4)->push_front(varDef);
-                                                       $$ = $4;
-                                                       delete $1; }
+id_type_list:   id_type_list T_COMMA T_ID decaf_type { VarDefAST* varDef = new VarDefAST(true, $3, $4);
+                                                       ((decafStmtList*)$1)->push_back(varDef);
+                                                       $$ = $1; }
     |           T_ID decaf_type { decafStmtList* list = new decafStmtList();
-                                  VarDefAST* varDef = new VarDefAST(true, *$1, *$2);
-                                  list->push_front(varDef);
-                                  delete $1;
+                                  VarDefAST* varDef = new VarDefAST(true, $1, $2);
+                                  list->push_back(varDef);
                                   $$ = list; }
     ;
 
-method: T_FUNC T_ID T_LPAREN method_type_list T_RPAREN method_type method_block { decafStmtList* list = new decafStmtList();
-                                                                                  MethodAST* method = new MethodAST(*$2, *$6, (decafStmtList*)$4, (MethodBlockAST*)$7);
-                                                                                  list->push_front(method);
-                                                                                  delete $2;
-                                                                                  delete $6;
-                                                                                  $$ = (decafAST*)method; }
-                                                                                  // $$ = list;
-                                                                                  // delete $2;
-                                                                                  // delete $6; }
+method: T_FUNC T_ID T_LPAREN method_type_list T_RPAREN method_type method_block { $$ = new MethodAST($2, $6, (decafStmtList*)$4, (MethodBlockAST*)$7); }
     ;
 
-method_list: { $$ = NULL; }
-    |        method method_list { decafStmtList* list;
-                                  if ($2) {
-                                      list = (decafStmtList*)$2;
+method_list: %empty { $$ = NULL; }
+    |        method_list method { decafStmtList* list;
+                                  if ($1) {
+                                      list = (decafStmtList*)$1;
                                   } else {
                                       list = new decafStmtList();
                                   }
-                                  list->push_front($1);
-                                  $$ = list; }      
+                                  list->push_back($2);
+                                  $$ = list; }
     ;
 
 /* same structure as var_decl_list */
-statement_list: statement statement_list { decafStmtList* list;
-                                           if ($2) {
-                                               list = (decafStmtList*)$2;
+statement_list: statement_list statement { decafStmtList* list;
+                                           if ($1) {
+                                               list = (decafStmtList*)$1;
                                            } else {
                                                list = new decafStmtList();
                                            }
-                                           list->push_front($1);
+                                           list->push_back($2);
                                            $$ = list; }
-    |           { $$ = NULL; }
+    |           %empty { $$ = NULL; }
     ;
 
-block: begin_block var_decl_list statement_list end_block { $$ = new BlockAST((decafStmtList*)$2, (decafStmtList*)$3); }
+block: T_LCB var_decl_list statement_list T_RCB { $$ = new BlockAST((decafStmtList*)$2, (decafStmtList*)$3); }
     ;
 
 statement: assign T_SEMICOLON { $$ = $1; }
@@ -401,31 +401,270 @@ statement: assign T_SEMICOLON { $$ = $1; }
 
 %%
 
-int main() {
-  // initialize LLVM
-  llvm::LLVMContext &Context = TheContext;
-
-  // Make the module, which holds all the code.
-  TheModule = new llvm::Module("Test", Context);
-  
-  // set up symbol table
-  symtbl.push_front(symbol_table());
-  // set up dummy main function
-  // TheFunction = gen_main_def();
+int decaf_parse(decaf_parser &parser) {
+  parser.program = NULL;
+  parser.scanner = scan_begin(&parser);
+  int retval = yyparse(parser.scanner);
+  scan_end(parser.scanner);
+  parser.scanner = NULL;
+  return retval;
+}
+
+#ifndef DECAF_LIBRARY
+
+/// output_name - NAME.decaf becomes NAME plus the suffix for emitKind,
+/// in the current directory
+static string output_name(const char *path) {
+  const char *slash = strrchr(path, '/');
+  string name(slash ? slash + 1 : path);
+  if (name.size() > 6 && name.compare(name.size() - 6, 6, ".decaf") == 0) {
+    name.resize(name.size() - 6);
+  }
+  return name + emit_extension(emitKind);
+}
+
+/// wants_stdlib - whether to link the stdlib into the module: when it is
+/// written as an object, assembly or bitcode, or optimized, so its calls
+/// can be inlined.  Printed IR keeps them as declarations.
+static bool wants_stdlib() {
+  return linkStdlib && (emitKind == EmitObj || emitKind == EmitAsm || emitKind == EmitBC || optLevel > 0 || !passPipeline.empty());
+}
+
+/// link_stdlib - decaf_link_stdlib, except that failing only costs the
+/// inlining: the module keeps its declarations and warning says so, as
+/// an IR comment since it goes out with the printed IR
+static void link_stdlib(std::unique_ptr<llvm::Module> &module, string &warning) {
+  string error;
+  if (!decaf_link_stdlib(module, error)) {
+    warning = "; warning: " + error + ", so the stdlib stays external";
+  }
+}
+
+/// print_stats - the --stats report, as IR comments
+static void print_stats(const front_end_stats &stats) {
+  llvm::errs() << "; intern: " << stats.lookups << " lookups, " << stats.hits << " hits ("
+               << llvm::format("%.1f", stats.lookups ? 100.0 * stats.hits / stats.lookups : 0.0) << "%), "
+               << stats.spellings << " distinct spellings in " << stats.spelling_bytes << " bytes\n";
+  llvm::errs() << "; arena: " << stats.nodes << " nodes, "
+               << stats.bytes_used << " bytes used, "
+               << stats.bytes_reserved << " bytes reserved in "
+               << stats.chunks << " chunks\n";
+  if (astOpt) {
+    ast_opt_stats ast = stats.ast;
+    llvm::errs() << "; ast: " << ast.total() << " nodes eliminated ("
+                 << ast.folded << " folded, " << ast.simplified << " simplified, "
+                 << ast.reused << " reused)\n";
+  }
+}
+
+/// compile_files - compile each file on its own LLVMContext using a pool
+/// of jobs threads (0 means one per core), then print the modules in the
+/// order the files were given.  With --emit each job also writes its own
+/// output file, so code generation for the target runs in parallel too.
+/// Each job's front end counts are added to frontEndStats.
+static int compile_files(const vector<const char *> &paths, unsigned jobs) {
+  struct compile_job {
+    llvm::LLVMContext context;
+    std::unique_ptr<llvm::Module> module;	// destroyed before context
+    string error;
+    string warning;	// from link_stdlib
+    front_end_stats stats;
+    bool ok = false;
+  };
+  vector<std::unique_ptr<compile_job> > results;
+  llvm::ThreadPool pool(llvm::hardware_concurrency(jobs));
+  for (const char *path : paths) {
+    compile_job *job = new compile_job;
+    results.push_back(std::unique_ptr<compile_job>(job));
+    pool.async([job, path]() {
+      decaf_parser parser;
+      if (!parser.source.open(path)) {
+        job->error = "could not read file";
+        return;
+      }
+      job->module = decaf_compile(parser, job->context, job->error, astOpt, boundsCheck, ssaCodegen, &job->stats);
+      if (job->module != NULL && wants_stdlib()) {
+        link_stdlib(job->module, job->warning);
+      }
+      job->ok = job->module != NULL && decaf_optimize(*job->module, optLevel, passPipeline, job->error);
+      if (job->ok && emitKind != EmitNone) {
+        job->ok = decaf_emit(*job->module, emitKind, output_name(path), job->error, codegen_level(optLevel));
+      }
+    });
+  }
+  pool.wait();
+
+  int status = EXIT_SUCCESS;
+  for (size_t i = 0; i < paths.size(); i++) {
+    frontEndStats.add(results[i]->stats);
+    if (!results[i]->warning.empty()) {
+      cerr << results[i]->warning << " (" << paths[i] << ")" << endl;
+    }
+    if (results[i]->ok) {
+      if (emitKind == EmitNone) {
+        results[i]->module->print(llvm::errs(), nullptr);
+      }
+    } else {
+      cerr << paths[i] << ": " << results[i]->error << endl;
+      status = EXIT_FAILURE;
+    }
+  }
+  return status;
+}
+
+int main(int argc, char **argv) {
+  vector<const char *> paths;
+  unsigned jobs = 0;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--stats") == 0) {
+      printStats = true;
+    } else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+      jobs = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+      outputPath = argv[++i];
+    } else if (strncmp(argv[i], "--emit=", 7) == 0 && parse_emit(argv[i] + 7) != EmitNone) {
+      emitKind = parse_emit(argv[i] + 7);
+    } else if (strncmp(argv[i], "-O", 2) == 0 && argv[i][2] >= '0' && argv[i][2] <= '3' && argv[i][3] == '\0') {
+      optLevel = argv[i][2] - '0';
+    } else if (strcmp(argv[i], "--bounds-check") == 0) {
+      boundsCheck = true;
+    } else if (strcmp(argv[i], "--ssa") == 0) {
+      ssaCodegen = true;
+    } else if (strcmp(argv[i], "--no-stdlib") == 0) {
+      linkStdlib = false;
+    } else if (strcmp(argv[i], "--no-ast-opt") == 0) {
+      astOpt = false;
+    } else if (strncmp(argv[i], "--passes=", 9) == 0) {
+      passPipeline = argv[i] + 9;
+    } else if (strcmp(argv[i], "--run") == 0) {
+      runProgram = true;
+    } else if (strcmp(argv[i], "--tier") == 0) {
+      runProgram = tieredRun = true;
+    } else if (strcmp(argv[i], "--vm") == 0) {
+      runProgram = vmRun = true;
+    } else if (strncmp(argv[i], "--tier-calls=", 13) == 0) {
+      tierOptions.calls = atoi(argv[i] + 13);
+    } else if (strncmp(argv[i], "--tier-loops=", 13) == 0) {
+      tierOptions.loops = atoi(argv[i] + 13);
+    } else if (strcmp(argv[i], "--tier-log") == 0) {
+      tierOptions.log = true;
+    } else if (argv[i][0] != '-') {
+      paths.push_back(argv[i]);
+    } else {
+      cerr << "usage: " << argv[0] << " [--stats] [-j N] [-O0|-O1|-O2|-O3] [--no-ast-opt] [--no-stdlib] [--bounds-check] [--ssa] [--passes=PIPELINE] [-o output] [--emit=obj|asm|bc|ll]"
+           << " [--run | --vm | --tier [--tier-calls=N] [--tier-loops=N] [--tier-log]] [input.decaf ...]" << endl;
+      return EXIT_FAILURE;
+    }
+  }
+  if (outputPath != NULL && emitKind == EmitNone) {
+    emitKind = EmitObj;
+  }
+  if (outputPath != NULL && paths.size() > 1) {
+    cerr << "-o needs a single input file" << endl;
+    return EXIT_FAILURE;
+  }
+  if (tieredRun && optLevel > 0) {
+    // -O picks the optimizing tier; tier 0 is never optimized
+    tierOptions.level = optLevel;
+    optLevel = -1;
+  }
+  if (runProgram && (paths.size() != 1 || emitKind != EmitNone)) {
+    // the program's standard input is ours, so its source must be a file
+    cerr << "--run needs a single input file and no -o or --emit" << endl;
+    return EXIT_FAILURE;
+  }
+  if (paths.size() > 1) {
+    int status = compile_files(paths, jobs);
+    if (printStats) {
+      print_stats(frontEndStats);
+    }
+    return status;
+  }
+  const char *path = paths.empty() ? NULL : paths[0];
+
+  // read the whole program up front (mapped when it is a regular file,
+  // including a redirected stdin) and scan it in place
+  decaf_parser parser;
+  if (!(path ? parser.source.open(path) : parser.source.open(STDIN_FILENO))) {
+    cerr << "could not read " << (path ? path : "standard input") << endl;
+    return EXIT_FAILURE;
+  }
+
   // parse the input and create the abstract syntax tree
-  int retval = yyparse();
-  // remove symbol table
-  // Finish off the main function. (see the WARNING above)
-  // return 0 from main, which is EXIT_SUCCESS
-  // Builder.CreateRet(llvm::ConstantInt::get(TheContext, llvm::APInt(32, 0)));
-  // Validate the generated code, checking for consistency.
-  // verifyFunction(*TheFunction);
-
-  symbol_table symtbl_front = symtbl.front();
-  symtbl.pop_front(); 
-  
-  // Print out all of the generated code to stderr
-  TheModule->print(llvm::errs(), nullptr);
-  return(retval >= 1 ? EXIT_FAILURE : EXIT_SUCCESS);
+  std::unique_ptr<llvm::LLVMContext> TheContext(new llvm::LLVMContext);
+  std::unique_ptr<llvm::Module> TheModule;
+  int status = EXIT_SUCCESS;
+  int retval = decaf_parse(parser);
+  if (retval != 0) {
+    cerr << parser.error << endl;
+  } else if (parser.program != NULL) {
+    if (printAST) {
+      cout << getString(parser.program) << endl;
+    }
+    if (astOpt) {
+      decaf_optimize_ast(parser, frontEndStats.ast);
+    }
+    string error;
+    if (vmRun) {
+      vm_program program;
+      if (!decaf_lower(parser, program, error)) {
+        cout << "semantic error: " << error << endl;
+        exit(EXIT_FAILURE);
+      }
+      if (!vm_run(program, status, error)) {
+        cerr << error << endl;
+        retval = 1;
+      }
+    } else {
+      TheModule = decaf_codegen(parser, *TheContext, error, boundsCheck, ssaCodegen);
+      if (!TheModule) {
+        cout << "semantic error: " << error << endl;
+        exit(EXIT_FAILURE);
+      }
+      if (!runProgram && wants_stdlib()) {
+        string warning;
+        link_stdlib(TheModule, warning);
+        if (!warning.empty()) {
+          cerr << warning << endl;
+        }
+      }
+      if (!decaf_optimize(*TheModule, optLevel, passPipeline, error)) {
+        cerr << error << endl;
+        exit(EXIT_FAILURE);
+      }
+    }
+  }
+
+  // Print out all of the generated code to stderr, write it where -o and
+  // --emit asked for it (standard output when reading stdin) or run it
+  if (TheModule && tieredRun) {
+    string error;
+    if (!decaf_run_tiered(std::move(TheModule), std::move(TheContext), tierOptions, status, error)) {
+      cerr << error << endl;
+      retval = 1;
+    }
+  } else if (TheModule && runProgram) {
+    string error;
+    if (!decaf_run(std::move(TheModule), std::move(TheContext), codegen_level(optLevel), status, error)) {
+      cerr << error << endl;
+      retval = 1;
+    }
+  } else if (TheModule && emitKind != EmitNone) {
+    string error;
+    string output = outputPath ? string(outputPath) : path ? output_name(path) : string("-");
+    if (!decaf_emit(*TheModule, emitKind, output, error, codegen_level(optLevel))) {
+      cerr << error << endl;
+      retval = 1;
+    }
+  } else if (TheModule) {
+    TheModule->print(llvm::errs(), nullptr);
+  }
+  // the whole AST goes in one bulk free, and the spellings with it
+  decaf_release(&frontEndStats);
+  if (printStats) {
+    print_stats(frontEndStats);
+  }
+  return(retval >= 1 ? EXIT_FAILURE : status);
 }
 
+#endif
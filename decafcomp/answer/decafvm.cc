@@ -0,0 +1,61 @@
+// decafvm: decafcomp --vm with no LLVM linked in
+//
+// The front end is decafcomp.y built with -DDECAF_LIBRARY -DDECAF_NO_LLVM,
+// so there is no code generation, only lowering to bytecode for vm_run
+// (vm.h).  Errors and the exit status are decafcomp --vm's.
+
+#include "decaf.h"
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+using namespace std;
+
+int main(int argc, char **argv) {
+	bool astOpt = true;
+	const char *path = NULL;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--no-ast-opt") == 0) {
+			astOpt = false;
+		} else if (argv[i][0] != '-' && path == NULL) {
+			path = argv[i];
+		} else {
+			path = NULL;
+			break;
+		}
+	}
+	if (path == NULL) {
+		// the program's standard input is ours, so its source must be a file
+		cerr << "usage: " << argv[0] << " [--no-ast-opt] input.decaf" << endl;
+		return EXIT_FAILURE;
+	}
+
+	decaf_parser parser;
+	if (!parser.source.open(path)) {
+		cerr << "could not read " << path << endl;
+		return EXIT_FAILURE;
+	}
+	int status = EXIT_SUCCESS;
+	int retval = decaf_parse(parser);
+	if (retval != 0) {
+		cerr << parser.error << endl;
+	} else if (parser.program != NULL) {
+		if (astOpt) {
+			ast_opt_stats removed;
+			decaf_optimize_ast(parser, removed);
+		}
+		string error;
+		vm_program program;
+		if (!decaf_lower(parser, program, error)) {
+			cout << "semantic error: " << error << endl;
+			exit(EXIT_FAILURE);
+		}
+		if (!vm_run(program, status, error)) {
+			cerr << error << endl;
+			retval = 1;
+		}
+	}
+	decaf_release(NULL);
+	return retval >= 1 ? EXIT_FAILURE : status;
+}
@@ -2,12 +2,26 @@
 #ifndef _DECAF_DEFS
 #define _DECAF_DEFS
 
+// the AST keeps its names as StringRefs, which are header only; built
+// with -DDECAF_NO_LLVM (decafvm in the makefile) nothing else of LLVM
+// is used or linked
+#include "llvm/ADT/StringRef.h"
+#ifndef DECAF_NO_LLVM
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/IR/CFG.h"
 #include "llvm/IR/DerivedTypes.h"
 #include "llvm/IR/LLVMContext.h"
 #include "llvm/IR/Module.h"
 #include "llvm/IR/Type.h"
 #include "llvm/IR/Verifier.h"
 #include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/MDBuilder.h"
+#include "llvm/IR/ValueHandle.h"
+#include "llvm/Transforms/Utils/Local.h"
+#else
+namespace llvm { class Value; }
+#endif
 #include <cstdio> 
 #include <cstdlib>
 #include <cstring> 
@@ -16,28 +30,36 @@
 #include <vector>
 #include <list>
 #include <map>
-
-extern int lineno;
-extern int tokenpos;
+#include <memory>
+#include "symtbl.h"
+#include "arena.h"
+#include "source.h"
+#include "vm.h"
 
 using namespace std;
 
-extern "C"
-{
-	extern int yyerror(const char *);
-	int yyparse(void);
-	int yylex(void);  
-	int yywrap(void);
-}
+// decaf_parser and the entry points libdecaf.a exports
+#include "decaf.h"
+
+// defined in decafcomp.lex
+extern yyscan_t scan_begin(decaf_parser *parser);
+extern void scan_end(yyscan_t scanner);
+extern decaf_parser *yyget_extra(yyscan_t scanner);
+extern int yyerror(yyscan_t scanner, const char *msg);
+
+// type, constant and operator tags carried from the parser into the AST
+enum decafType { TypeNone, TypeInt, TypeBool, TypeVoid, TypeString };
+enum decafConst { ConstNumber, ConstBool, ConstString };
+enum decafOp {
+	OpMult, OpDiv, OpMod, OpPlus, OpMinus, OpLeftShift, OpRightShift,
+	OpEq, OpNeq, OpGeq, OpLeq, OpGt, OpLt, OpAnd, OpOr, OpNot, OpUnaryMinus
+};
 
 typedef struct { 
-	std::string* type;
-	std::string* size;
+	decafType type;
+	symbol_id size;
 } array_info;
 
-typedef map<string, llvm::Value* > symbol_table;
-typedef list<symbol_table > symbol_table_list;
-extern symbol_table_list symtbl;
-extern llvm::Value* access_symtbl(string ident);
+extern thread_local symbol_interner symbols;
 
 #endif
\ No newline at end of file
@@ -0,0 +1,109 @@
+#!/usr/bin/env python3
+
+"""
+usage: %s [-c CODEGEN] [-n REPEAT] SOURCE-FILE...
+
+Time getting from Decaf source to a native object file two ways:
+
+text     CODEGEN prints LLVM assembly, then llvm-as, llc and CC -c
+         (what llvm-run -t does before linking)
+direct   CODEGEN -o NAME.o writes the object file in-process
+
+Linking and running are the same for both and are not timed.  Each file
+is compiled REPEAT times (default 5) and the fastest run is kept; files
+CODEGEN rejects are skipped.  Reports wall time, processes started and
+bytes written to disk per file and in total.
+
+Environment variables LLVMCONFIG and CC are used as in llvm-run.
+"""
+
+import getopt
+import os
+import os.path
+import shutil
+import subprocess
+import sys
+import tempfile
+import time
+
+llvm_config = os.environ.get('LLVMCONFIG') or 'llvm-config'
+bindir = subprocess.check_output([llvm_config, "--bindir"]).strip().decode('utf-8')
+llvmas = os.environ.get('LLVMAS') or os.path.join(bindir, 'llvm-as')
+llc = os.environ.get('LLC') or os.path.join(bindir, 'llc')
+cc = os.environ.get('CC') or 'clang'
+
+def call(argv, stdin=None, stderr=subprocess.DEVNULL):
+    return subprocess.call(argv, stdin=stdin, stdout=subprocess.DEVNULL, stderr=stderr) == 0
+
+def text_pipeline(codegen, source, tmp):
+    ll = os.path.join(tmp, "t.ll")
+    with open(source) as infile, open(ll, 'w') as errfile:
+        if not call([codegen], stdin=infile, stderr=errfile):
+            return None
+    ok = call([llvmas, ll, "-o", ll + ".bc"])
+    ok = ok and call([llc, ll + ".bc", "-o", ll + ".s"])
+    ok = ok and call([cc, "-c", ll + ".s", "-o", ll + ".o"])
+    return [ll, ll + ".bc", ll + ".s", ll + ".o"] if ok else None
+
+def direct(codegen, source, tmp):
+    obj = os.path.join(tmp, "d.o")
+    with open(source) as infile:
+        if not call([codegen, "-o", obj], stdin=infile):
+            return None
+    return [obj]
+
+def best_of(repeat, pipeline, codegen, source, tmp):
+    best = None
+    for _ in range(repeat):
+        start = time.perf_counter()
+        files = pipeline(codegen, source, tmp)
+        elapsed = time.perf_counter() - start
+        if files is None:
+            return None
+        best = elapsed if best is None else min(best, elapsed)
+    return best, len(files), sum(os.path.getsize(f) for f in files)
+
+def main():
+    codegen = os.path.join('.', 'decafcomp')
+    repeat = 5
+    try:
+        opts, args = getopt.getopt(sys.argv[1:], "c:n:")
+        for opt, value in opts:
+            if opt == "-c":
+                codegen = value
+            elif opt == "-n":
+                repeat = int(value)
+        if not args:
+            raise getopt.GetoptError("no source files")
+    except (getopt.GetoptError, ValueError):
+        print(__doc__ % (sys.argv[0]), file=sys.stderr)
+        sys.exit(2)
+
+    tmp = tempfile.mkdtemp(prefix="emit-bench.")
+    totals = [0.0, 0, 0.0, 0]
+    count = 0
+    try:
+        print("%-32s %10s %10s %10s %10s" % ("file", "text(ms)", "direct(ms)", "text(B)", "direct(B)"))
+        for source in args:
+            text = best_of(repeat, text_pipeline, codegen, source, tmp)
+            fast = best_of(repeat, direct, codegen, source, tmp) if text else None
+            if fast is None:
+                continue
+            count += 1
+            totals[0] += text[0]
+            totals[1] += text[2]
+            totals[2] += fast[0]
+            totals[3] += fast[2]
+            print("%-32s %10.2f %10.2f %10d %10d" % (os.path.basename(source)[:32], text[0] * 1000, fast[0] * 1000, text[2], fast[2]))
+    finally:
+        shutil.rmtree(tmp)
+
+    if count == 0:
+        print("no file compiled", file=sys.stderr)
+        sys.exit(1)
+    print("%-32s %10.2f %10.2f %10d %10d" % ("total (%d files)" % count, totals[0] * 1000, totals[2] * 1000, totals[1], totals[3]))
+    print("processes per file: text 4, direct 1; speedup %.1fx, %.1fx fewer bytes written"
+          % (totals[0] / totals[2], float(totals[1]) / totals[3]))
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,105 @@
+
+#ifndef _DECAF_EMIT
+#define _DECAF_EMIT
+
+#include <mutex>
+#include <string>
+#include "llvm/ADT/Triple.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/IR/Module.h"
+#include "llvm/MC/TargetRegistry.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Host.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Target/TargetMachine.h"
+#include "llvm/Target/TargetOptions.h"
+
+/// decafEmit - what decaf_emit writes for a module
+enum decafEmit { EmitNone, EmitLL, EmitBC, EmitAsm, EmitObj };
+
+/// parse_emit - map the argument of --emit= to a decafEmit,
+/// EmitNone if it names nothing we can write
+inline decafEmit parse_emit(const std::string &kind) {
+	if (kind == "ll") { return EmitLL; }
+	if (kind == "bc") { return EmitBC; }
+	if (kind == "asm") { return EmitAsm; }
+	if (kind == "obj") { return EmitObj; }
+	return EmitNone;
+}
+
+/// emit_extension - file suffix used when an output name has to be made up
+inline const char *emit_extension(decafEmit kind) {
+	switch (kind) {
+	case EmitLL: return ".ll";
+	case EmitBC: return ".bc";
+	case EmitAsm: return ".s";
+	default: return ".o";
+	}
+}
+
+/// init_native_target - register the host target with LLVM, once per
+/// process however many threads get here
+inline void init_native_target() {
+	static std::once_flag initialized;
+	std::call_once(initialized, []() {
+		llvm::InitializeNativeTarget();
+		llvm::InitializeNativeTargetAsmPrinter();
+	});
+}
+
+/// native_target_machine - a TargetMachine for the host, as llc would
+/// pick it.  Code is position independent so the object links into a
+/// PIE as well as a plain executable.
+inline llvm::TargetMachine *native_target_machine(std::string &error, llvm::CodeGenOpt::Level level = llvm::CodeGenOpt::Default) {
+	init_native_target();
+	std::string triple = llvm::sys::getDefaultTargetTriple();
+	const llvm::Target *target = llvm::TargetRegistry::lookupTarget(triple, error);
+	if (target == NULL) { return NULL; }
+	return target->createTargetMachine(triple, "generic", "", llvm::TargetOptions(), llvm::Reloc::PIC_, llvm::None, level);
+}
+
+/// decaf_emit - write module to path ("-" is standard output) as kind,
+/// without going through textual IR and the external llvm tools.
+/// Returns false and sets error on failure.
+inline bool decaf_emit(llvm::Module &module, decafEmit kind, const std::string &path, std::string &error,
+                       llvm::CodeGenOpt::Level level = llvm::CodeGenOpt::Default) {
+	std::unique_ptr<llvm::TargetMachine> machine(native_target_machine(error, level));
+	if (!machine) { return false; }
+	module.setTargetTriple(machine->getTargetTriple().str());
+	module.setDataLayout(machine->createDataLayout());
+
+	std::error_code ec;
+	llvm::raw_fd_ostream out(path, ec, kind == EmitLL || kind == EmitAsm ? llvm::sys::fs::OF_Text : llvm::sys::fs::OF_None);
+	if (ec) {
+		error = path + ": " + ec.message();
+		return false;
+	}
+	switch (kind) {
+	case EmitLL:
+		module.print(out, nullptr);
+		break;
+	case EmitBC:
+		llvm::WriteBitcodeToFile(module, out);
+		break;
+	default: {
+		llvm::legacy::PassManager passes;
+		llvm::CodeGenFileType type = kind == EmitAsm ? llvm::CGFT_AssemblyFile : llvm::CGFT_ObjectFile;
+		if (machine->addPassesToEmitFile(passes, out, nullptr, type)) {
+			error = "target cannot emit this file type";
+			return false;
+		}
+		passes.run(module);
+		}
+	}
+	out.flush();
+	if (out.has_error()) {
+		error = path + ": " + out.error().message();
+		out.clear_error();
+		return false;
+	}
+	return true;
+}
+
+#endif
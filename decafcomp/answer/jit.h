@@ -0,0 +1,92 @@
+
+#ifndef _DECAF_JIT
+#define _DECAF_JIT
+
+#include <string>
+#include "llvm/ExecutionEngine/Orc/ExecutionUtils.h"
+#include "llvm/ExecutionEngine/Orc/LLJIT.h"
+#include "llvm/ExecutionEngine/Orc/ThreadSafeModule.h"
+#include "emit.h"
+
+// the Decaf standard library, decaf-stdlib.c, is linked into decafcomp
+#include "decaf-stdlib.h"
+
+/// jit_failed - record err in error and report failure
+inline bool jit_failed(llvm::Error err, std::string &error) {
+	error = llvm::toString(std::move(err));
+	return false;
+}
+
+/// host_jit_builder - settings for a JIT generating code for this
+/// machine at the given backend level
+inline llvm::Expected<llvm::orc::JITTargetMachineBuilder> host_jit_builder(llvm::CodeGenOpt::Level level) {
+	init_native_target();
+	auto host = llvm::orc::JITTargetMachineBuilder::detectHost();
+	if (host) { host->setCodeGenOptLevel(level); }
+	return host;
+}
+
+/// bind_stdlib - make the stdlib externs resolve to the copies linked
+/// into decafcomp, and any other extern to whatever the process has
+inline bool bind_stdlib(llvm::orc::LLJIT &jit, std::string &error) {
+	llvm::orc::JITDylib &lib = jit.getMainJITDylib();
+	llvm::JITSymbolFlags flags = llvm::JITSymbolFlags::Exported | llvm::JITSymbolFlags::Callable;
+	llvm::orc::SymbolMap stdlib;
+	stdlib[jit.mangleAndIntern("print_int")] = llvm::JITEvaluatedSymbol(llvm::pointerToJITTargetAddress(&print_int), flags);
+	stdlib[jit.mangleAndIntern("print_string")] = llvm::JITEvaluatedSymbol(llvm::pointerToJITTargetAddress(&print_string), flags);
+	stdlib[jit.mangleAndIntern("read_int")] = llvm::JITEvaluatedSymbol(llvm::pointerToJITTargetAddress(&read_int), flags);
+	stdlib[jit.mangleAndIntern("decaf_bounds_error")] = llvm::JITEvaluatedSymbol(llvm::pointerToJITTargetAddress(&decaf_bounds_error), flags);
+	if (llvm::Error err = lib.define(llvm::orc::absoluteSymbols(std::move(stdlib)))) { return jit_failed(std::move(err), error); }
+	auto process = llvm::orc::DynamicLibrarySearchGenerator::GetForCurrentProcess(jit.getDataLayout().getGlobalPrefix());
+	if (!process) { return jit_failed(process.takeError(), error); }
+	lib.addGenerator(std::move(*process));
+	return true;
+}
+
+/// run_main - call the program's main and set status to what it returns
+/// (0 for a void main)
+inline bool run_main(llvm::orc::LLJIT &jit, bool returns_int, int &status, std::string &error) {
+	auto entry = jit.lookup("main");
+	if (!entry) { return jit_failed(entry.takeError(), error); }
+	if (returns_int) {
+		status = llvm::jitTargetAddressToFunction<int (*)()>(entry->getAddress())();
+	} else {
+		llvm::jitTargetAddressToFunction<void (*)()>(entry->getAddress())();
+		status = 0;
+	}
+	decaf_flush();
+	return true;
+}
+
+/// main_returns_int - check module has a main to run and say whether its
+/// value is the exit status
+inline bool main_returns_int(llvm::Module &module, bool &returns_int, std::string &error) {
+	llvm::Function *main_func = module.getFunction("main");
+	if (main_func == NULL || main_func->isDeclaration()) {
+		error = "no main method to run";
+		return false;
+	}
+	returns_int = main_func->getReturnType()->isIntegerTy(32);
+	return true;
+}
+
+/// decaf_run - execute module in this process with ORC's lazy JIT and set
+/// status to what its main returns.  Each method is compiled the first
+/// time it is called, so a short program starts running after compiling
+/// only main.  Returns false and sets error if the program cannot be run.
+inline bool decaf_run(std::unique_ptr<llvm::Module> module, std::unique_ptr<llvm::LLVMContext> context,
+                      llvm::CodeGenOpt::Level level, int &status, std::string &error) {
+	bool returns_int;
+	if (!main_returns_int(*module, returns_int, error)) { return false; }
+	auto host = host_jit_builder(level);
+	if (!host) { return jit_failed(host.takeError(), error); }
+	auto jit = llvm::orc::LLLazyJITBuilder().setJITTargetMachineBuilder(std::move(*host)).create();
+	if (!jit) { return jit_failed(jit.takeError(), error); }
+	if (!bind_stdlib(**jit, error)) { return false; }
+	if (llvm::Error err = (*jit)->addLazyIRModule(llvm::orc::ThreadSafeModule(std::move(module), std::move(context)))) {
+		return jit_failed(std::move(err), error);
+	}
+	return run_main(**jit, returns_int, status, error);
+}
+
+#endif
@@ -0,0 +1,75 @@
+
+#ifndef _DECAF_OPTIMIZE
+#define _DECAF_OPTIMIZE
+
+#include <string>
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Transforms/Scalar/InductiveRangeCheckElimination.h"
+#include "emit.h"
+
+/// codegen_level - the backend optimization level that goes with -O level,
+/// llc's default when no -O was given (level < 0)
+inline llvm::CodeGenOpt::Level codegen_level(int level) {
+	switch (level) {
+	case 0: return llvm::CodeGenOpt::None;
+	case 1: return llvm::CodeGenOpt::Less;
+	case 3: return llvm::CodeGenOpt::Aggressive;
+	default: return llvm::CodeGenOpt::Default;
+	}
+}
+
+/// decaf_optimize - run the standard -O level pipeline over module, or
+/// the opt-style pipeline text (e.g. "function(sroa,instcombine),gvn")
+/// when one is given.  The module must already verify (decaf_codegen
+/// checks).  -O0 with no pipeline leaves the module alone.
+/// Returns false and sets error on failure.
+inline bool decaf_optimize(llvm::Module &module, int level, const std::string &pipeline, std::string &error) {
+	if (level <= 0 && pipeline.empty()) { return true; }
+
+	// the target decides vector widths and inlining costs
+	std::unique_ptr<llvm::TargetMachine> machine(native_target_machine(error, codegen_level(level)));
+	if (!machine) { return false; }
+	module.setTargetTriple(machine->getTargetTriple().str());
+	module.setDataLayout(machine->createDataLayout());
+
+	llvm::PipelineTuningOptions tuning;
+	tuning.LoopVectorization = level >= 2;
+	tuning.SLPVectorization = level >= 2;
+	tuning.LoopInterleaving = level >= 2;
+	tuning.LoopUnrolling = level >= 1;
+
+	llvm::LoopAnalysisManager LAM;
+	llvm::FunctionAnalysisManager FAM;
+	llvm::CGSCCAnalysisManager CGAM;
+	llvm::ModuleAnalysisManager MAM;
+	llvm::PassBuilder builder(machine.get(), tuning);
+	// inductive range check elimination: a loop with --bounds-check
+	// tests gets a copy without them for the iterations known to be in
+	// range (other passes fold most of the rest into the loop exit test)
+	builder.registerScalarOptimizerLateEPCallback([](llvm::FunctionPassManager &passes, llvm::OptimizationLevel) {
+		passes.addPass(llvm::IRCEPass());
+	});
+	builder.registerModuleAnalyses(MAM);
+	builder.registerCGSCCAnalyses(CGAM);
+	builder.registerFunctionAnalyses(FAM);
+	builder.registerLoopAnalyses(LAM);
+	builder.crossRegisterProxies(LAM, FAM, CGAM, MAM);
+
+	llvm::ModulePassManager passes;
+	if (!pipeline.empty()) {
+		if (llvm::Error err = builder.parsePassPipeline(passes, pipeline)) {
+			error = "bad pass pipeline: " + llvm::toString(std::move(err));
+			return false;
+		}
+	} else {
+		static const llvm::OptimizationLevel levels[] = {
+			llvm::OptimizationLevel::O0, llvm::OptimizationLevel::O1,
+			llvm::OptimizationLevel::O2, llvm::OptimizationLevel::O3
+		};
+		passes = builder.buildPerModuleDefaultPipeline(levels[level > 3 ? 3 : level]);
+	}
+	passes.run(module, MAM);
+	return true;
+}
+
+#endif
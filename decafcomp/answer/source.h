@@ -0,0 +1,98 @@
+
+#ifndef _DECAF_SOURCE
+#define _DECAF_SOURCE
+
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/// source_buffer - the whole input program in memory, followed by the two
+/// NUL bytes flex wants at the end of a buffer it scans in place.
+/// Regular files are mapped privately: pages are read on demand and the
+/// scanner's temporary NUL after each token only copies the page it lands
+/// on.  Anything else (a pipe, a terminal) is read into the heap.
+class source_buffer {
+	char *base;
+	size_t len;
+	size_t mapped;	// bytes mapped, 0 if base came from malloc
+
+	bool map_file(int fd, size_t size) {
+		size_t page = sysconf(_SC_PAGESIZE);
+		size_t total = (size + 2 + page - 1) & ~(page - 1);
+		// reserve zeroed pages first so the terminating NULs exist even
+		// when the file ends exactly on a page boundary, then lay the
+		// file over the front of the reservation
+		void *area = mmap(NULL, total, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (area == MAP_FAILED) { return false; }
+		if (size > 0 && mmap(area, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+			munmap(area, total);
+			return false;
+		}
+		madvise(area, total, MADV_SEQUENTIAL);
+		base = (char *)area;
+		len = size;
+		mapped = total;
+		return true;
+	}
+	bool read_stream(int fd) {
+		size_t cap = 64 * 1024;
+		char *buf = (char *)malloc(cap);
+		size_t n = 0;
+		for (;;) {
+			if (buf == NULL) { return false; }
+			if (n + 2 == cap) {
+				cap *= 2;
+				char *grown = (char *)realloc(buf, cap);
+				if (grown == NULL) { free(buf); return false; }
+				buf = grown;
+			}
+			ssize_t got = read(fd, buf + n, cap - n - 2);
+			if (got < 0) { free(buf); return false; }
+			if (got == 0) { break; }
+			n += got;
+		}
+		buf[n] = buf[n + 1] = '\0';
+		base = buf;
+		len = n;
+		mapped = 0;
+		return true;
+	}
+	void release() {
+		if (base == NULL) { return; }
+		if (mapped) { munmap(base, mapped); } else { free(base); }
+		base = NULL;
+		len = mapped = 0;
+	}
+public:
+	source_buffer() : base(NULL), len(0), mapped(0) {}
+	~source_buffer() { release(); }
+	source_buffer(const source_buffer &) = delete;
+	source_buffer &operator=(const source_buffer &) = delete;
+
+	/// open - load the program from fd, mapping it when fd is a regular
+	/// file and reading it otherwise
+	bool open(int fd) {
+		release();
+		struct stat st;
+		if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+			if (map_file(fd, st.st_size)) { return true; }
+		}
+		return read_stream(fd);
+	}
+	bool open(const char *path) {
+		int fd = ::open(path, O_RDONLY);
+		if (fd < 0) { return false; }
+		bool ok = open(fd);
+		close(fd);	// a mapping stays valid after its descriptor is closed
+		return ok;
+	}
+
+	char *data() { return base; }
+	size_t size() const { return len; }
+	bool is_mapped() const { return mapped != 0; }
+};
+
+#endif
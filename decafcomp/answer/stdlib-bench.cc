@@ -0,0 +1,127 @@
+// stdlib-bench: cost of print_int, print_string and read_int in
+// decaf-stdlib.c
+//
+// Prints COUNT integers (spread over every length, negative ones too),
+// first alone and then each followed by a print_string(" "), as a Decaf
+// program printing a list would.  Output goes to /dev/null, so only the
+// library's own work is timed.  Then writes INPUTS integers (100M unless
+// given as the argument), one per line, to a temporary file and reads
+// them back through stdin.  The printf and scanf-per-call functions the
+// stdlib used to have are timed alongside for comparison.
+
+#include "decaf-stdlib.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace std;
+
+static const int COUNT = 10000000;
+static const long INPUTS = 100000000;
+
+static void old_print_int(int x) {
+	printf("%d", x);
+}
+
+static void old_print_string(const char *s) {
+	printf("%s", s);
+}
+
+static int old_read_int() {
+	int i = 0;
+	scanf("%d", &i);
+	return i;
+}
+
+// the i'th integer printed: a different length every few values
+static inline int value(int i) {
+	return (int)((unsigned)i * 2654435761u) >> (i & 31);
+}
+
+template <class F>
+static double ms(F f) {
+	auto start = chrono::steady_clock::now();
+	f();
+	auto stop = chrono::steady_clock::now();
+	return chrono::duration<double, milli>(stop - start).count();
+}
+
+// sum of the INPUTS integers read by read, to check both agree
+template <class F>
+static long long read_all(long inputs, F read) {
+	long long sum = 0;
+	for (long i = 0; i < inputs; i++) { sum += read(); }
+	return sum;
+}
+
+int main(int argc, char **argv) {
+	long inputs = argc > 1 ? atol(argv[1]) : INPUTS;
+	char path[] = "/tmp/stdlib-bench.XXXXXX";
+	int fd = mkstemp(path);
+	FILE *file = fd < 0 ? NULL : fdopen(fd, "w");
+	if (file == NULL) {
+		perror(path);
+		return 1;
+	}
+	long long expected = 0;
+	for (long i = 0; i < inputs; i++) {
+		expected += value(i);
+		fprintf(file, "%d\n", value(i));
+	}
+	fclose(file);
+
+	if (freopen("/dev/null", "w", stdout) == NULL) {
+		perror("/dev/null");
+		return 1;
+	}
+	double old_ints = ms([]() {
+		for (int i = 0; i < COUNT; i++) { old_print_int(value(i)); }
+		fflush(stdout);
+	});
+	double new_ints = ms([]() {
+		for (int i = 0; i < COUNT; i++) { print_int(value(i)); }
+		decaf_flush();
+	});
+	double old_list = ms([]() {
+		for (int i = 0; i < COUNT; i++) {
+			old_print_int(value(i));
+			old_print_string(" ");
+		}
+		fflush(stdout);
+	});
+	double new_list = ms([]() {
+		for (int i = 0; i < COUNT; i++) {
+			print_int(value(i));
+			print_string(" ");
+		}
+		decaf_flush();
+	});
+
+	long long old_sum = 0, new_sum = 0;
+	if (freopen(path, "r", stdin) == NULL) {
+		perror(path);
+		return 1;
+	}
+	double old_read = ms([&]() { old_sum = read_all(inputs, old_read_int); });
+	fd = open(path, O_RDONLY);
+	if (fd < 0 || dup2(fd, STDIN_FILENO) < 0) {
+		perror(path);
+		return 1;
+	}
+	double new_read = ms([&]() { new_sum = read_all(inputs, read_int); });
+	unlink(path);
+
+	fprintf(stderr, "%-24s %12s %12s %8s\n", "10M integers", "printf(ms)", "buffered(ms)", "speedup");
+	fprintf(stderr, "%-24s %12.1f %12.1f %7.1fx\n", "print_int", old_ints, new_ints, old_ints / new_ints);
+	fprintf(stderr, "%-24s %12.1f %12.1f %7.1fx\n", "print_int, print_string", old_list, new_list, old_list / new_list);
+	fprintf(stderr, "\n%-24s %12s %12s %8s\n", (to_string(inputs / 1000000) + "M integers").c_str(), "scanf(ms)", "scanner(ms)", "speedup");
+	fprintf(stderr, "%-24s %12.1f %12.1f %7.1fx\n", "read_int", old_read, new_read, old_read / new_read);
+	if (old_sum != expected || new_sum != expected) {
+		fprintf(stderr, "read_int: sums differ (%lld scanf, %lld scanner, %lld written)\n", old_sum, new_sum, expected);
+		return 1;
+	}
+	return 0;
+}
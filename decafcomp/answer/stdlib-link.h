@@ -0,0 +1,50 @@
+
+#ifndef _DECAF_STDLIB_LINK
+#define _DECAF_STDLIB_LINK
+
+#include <string>
+#include "llvm/ADT/StringSet.h"
+#include "llvm/Bitcode/BitcodeReader.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Linker/Linker.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+
+// decaf-stdlib.c compiled to bitcode by the makefile, as the byte array
+// decaf_stdlib_bc (xxd -i)
+#include "decaf-stdlib-bc.h"
+
+/// decaf_link_stdlib - copy the stdlib functions module calls (and what
+/// they use in turn) from the bitcode built into decafcomp into module,
+/// with internal linkage.  The optimizer can then inline print_int and
+/// friends into the program, and the object written for module links
+/// without decaf-stdlib.o (or next to it: the copies are private).
+/// Returns false and sets error on failure, leaving module as it was:
+/// the stdlib calls stay external declarations, to link against
+/// decaf-stdlib.o instead.
+inline bool decaf_link_stdlib(std::unique_ptr<llvm::Module> &module, std::string &error) {
+	llvm::StringRef bytes((const char *)decaf_stdlib_bc, decaf_stdlib_bc_len);
+	auto parsed = llvm::parseBitcodeFile(llvm::MemoryBufferRef(bytes, "decaf-stdlib.bc"), module->getContext());
+	if (!parsed) {
+		error = "decaf-stdlib.bc: " + llvm::toString(parsed.takeError());
+		return false;
+	}
+	// the linker may have changed the module by the time it fails, so it
+	// works on a copy
+	std::unique_ptr<llvm::Module> linked = llvm::CloneModule(*module);
+	bool failed = llvm::Linker::linkModules(*linked, std::move(*parsed), llvm::Linker::LinkOnlyNeeded,
+		[](llvm::Module &dest, const llvm::StringSet<> &names) {
+			for (const auto &name : names) {
+				llvm::GlobalValue *value = dest.getNamedValue(name.getKey());
+				if (value != NULL && !value->isDeclaration()) { value->setLinkage(llvm::GlobalValue::InternalLinkage); }
+			}
+		});
+	if (failed) {
+		error = "could not link decaf-stdlib.bc into the program";
+		return false;
+	}
+	module = std::move(linked);
+	return true;
+}
+
+#endif
@@ -0,0 +1,35 @@
+#!/usr/bin/env python3
+
+"""
+usage: %s [N]
+
+Write a Decaf program to standard output whose main method holds N
+statements (default 1000000) in a single statement list, followed by a
+call that prints the final count.  Used by `make stress` to check that the
+parser handles very long lists without running out of stack.
+
+The program prints N when compiled and run.
+"""
+
+import sys
+
+def main():
+    try:
+        n = int(sys.argv[1]) if len(sys.argv) > 1 else 1000000
+    except ValueError:
+        print(__doc__ % (sys.argv[0]), file=sys.stderr)
+        sys.exit(2)
+
+    out = sys.stdout
+    out.write("extern func print_int(int) void;\n\n")
+    out.write("package Stress {\n")
+    out.write("    func main() int {\n")
+    out.write("        var x int;\n")
+    out.write("        x = 0;\n")
+    out.write("        x = x + 1;\n" * n)
+    out.write("        print_int(x);\n")
+    out.write("    }\n")
+    out.write("}\n")
+
+if __name__ == '__main__':
+    main()
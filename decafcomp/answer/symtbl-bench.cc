@@ -0,0 +1,90 @@
+
+// symtbl-bench: lookup cost of the scoped symbol table as scope depth grows
+//
+// For each depth D we open D nested scopes with LOCALS names each and then
+// look up a name from the outermost scope (the worst case for a chained
+// search) and one from the innermost scope.  The old list<map> table is
+// timed alongside for comparison, using the same by-value scan that
+// access_symtbl used to do.
+
+#include "symtbl.h"
+#include <chrono>
+#include <cstdio>
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+typedef map<string, int> old_scope;
+
+static const int LOCALS = 16;
+static const int LOOKUPS = 200000;
+
+static int old_lookup(list<old_scope> &tbl, const string &ident) {
+	for (auto i : tbl) {
+		auto find_ident = i.find(ident);
+		if (find_ident != i.end()) {
+			return find_ident->second;
+		}
+	}
+	return 0;
+}
+
+static string var_name(int scope, int n) {
+	return string("v") + to_string(scope) + "_" + to_string(n);
+}
+
+template <class F>
+static double ns_per_op(int ops, F f) {
+	auto start = chrono::steady_clock::now();
+	f();
+	auto stop = chrono::steady_clock::now();
+	return chrono::duration<double, nano>(stop - start).count() / ops;
+}
+
+int main() {
+	int depths[] = { 1, 4, 16, 64, 256, 1024 };
+	volatile int sink = 0;
+
+	printf("%8s %14s %14s %14s %14s\n", "depth", "new-outer(ns)", "new-inner(ns)", "old-outer(ns)", "old-inner(ns)");
+	for (int depth : depths) {
+		symbol_interner symbols;
+		scoped_symbol_table<int> tbl;
+		list<old_scope> old_tbl;
+
+		for (int d = 0; d < depth; d++) {
+			tbl.push_scope();
+			old_tbl.push_front(old_scope());
+			for (int n = 0; n < LOCALS; n++) {
+				string name = var_name(d, n);
+				tbl.insert(symbols.intern(name), d * LOCALS + n + 1);
+				old_tbl.front()[name] = d * LOCALS + n + 1;
+			}
+		}
+		string outer = var_name(0, 0);
+		string inner = var_name(depth - 1, 0);
+		symbol_id outer_sym = symbols.intern(outer);
+		symbol_id inner_sym = symbols.intern(inner);
+
+		double new_outer = ns_per_op(LOOKUPS, [&]() {
+			for (int i = 0; i < LOOKUPS; i++) { sink += tbl.lookup(outer_sym); }
+		});
+		double new_inner = ns_per_op(LOOKUPS, [&]() {
+			for (int i = 0; i < LOOKUPS; i++) { sink += tbl.lookup(inner_sym); }
+		});
+		// the old table is orders of magnitude slower; scale its loop down
+		int old_ops = LOOKUPS / depth / 4 + 1;
+		double old_outer = ns_per_op(old_ops, [&]() {
+			for (int i = 0; i < old_ops; i++) { sink += old_lookup(old_tbl, outer); }
+		});
+		double old_inner = ns_per_op(old_ops, [&]() {
+			for (int i = 0; i < old_ops; i++) { sink += old_lookup(old_tbl, inner); }
+		});
+		printf("%8d %14.2f %14.2f %14.2f %14.2f\n", depth, new_outer, new_inner, old_outer, old_inner);
+
+		while (tbl.depth() > 0) { tbl.pop_scope(); }
+	}
+	return 0;
+}
@@ -0,0 +1,178 @@
+
+#ifndef _DECAF_SYMTBL
+#define _DECAF_SYMTBL
+
+#include <cstring>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+/// symbol_id - small dense integer naming an interned identifier
+typedef int symbol_id;
+
+/// symbol_interner - maps each distinct spelling to a symbol_id.
+/// Open addressing with linear probing; the table stores ids, and each
+/// spelling is copied once into append-only blocks so the text behind an
+/// id never moves and can be handed out as a plain pointer.
+class symbol_interner {
+	static const size_t BLOCK_SIZE = 16 * 1024;
+	std::vector<const char *> texts;
+	std::vector<uint32_t> lengths;
+	std::vector<uint32_t> hashes;
+	std::vector<symbol_id> slots;	// -1 marks an empty slot
+	size_t mask;
+	std::vector<char *> blocks;
+	char *free_ptr;
+	size_t free_left;
+	size_t n_lookups;
+	size_t n_hits;
+	size_t n_bytes;
+
+	static uint32_t hash(const char *s, size_t len) {
+		uint32_t h = 2166136261u;	// FNV-1a
+		for (size_t i = 0; i < len; i++) {
+			h = (h ^ (unsigned char)s[i]) * 16777619u;
+		}
+		return h;
+	}
+	void grow() {
+		std::vector<symbol_id> old(slots.size() * 2, -1);
+		slots.swap(old);
+		mask = slots.size() - 1;
+		for (symbol_id id = 0; id < (symbol_id)texts.size(); id++) {
+			size_t i = hashes[id] & mask;
+			while (slots[i] != -1) { i = (i + 1) & mask; }
+			slots[i] = id;
+		}
+	}
+	const char *store(const char *s, size_t len) {
+		if (len + 1 > free_left) {
+			size_t size = len + 1 > BLOCK_SIZE ? len + 1 : BLOCK_SIZE;
+			blocks.push_back(new char[size]);
+			free_ptr = blocks.back();
+			free_left = size;
+		}
+		char *p = free_ptr;
+		memcpy(p, s, len);
+		p[len] = '\0';
+		free_ptr += len + 1;
+		free_left -= len + 1;
+		n_bytes += len + 1;
+		return p;
+	}
+public:
+	symbol_interner() : slots(256, -1), mask(255), free_ptr(NULL), free_left(0), n_lookups(0), n_hits(0), n_bytes(0) {}
+	~symbol_interner() {
+		for (size_t i = 0; i < blocks.size(); i++) { delete[] blocks[i]; }
+	}
+	symbol_interner(const symbol_interner &) = delete;
+	symbol_interner &operator=(const symbol_interner &) = delete;
+
+	symbol_id intern(const char *s, size_t len) {
+		uint32_t h = hash(s, len);
+		size_t i = h & mask;
+		n_lookups++;
+		while (slots[i] != -1) {
+			symbol_id id = slots[i];
+			if (hashes[id] == h && lengths[id] == len && memcmp(texts[id], s, len) == 0) {
+				n_hits++;
+				return id;
+			}
+			i = (i + 1) & mask;
+		}
+		symbol_id id = texts.size();
+		texts.push_back(store(s, len));
+		lengths.push_back(len);
+		hashes.push_back(h);
+		slots[i] = id;
+		if (texts.size() * 2 > slots.size()) { grow(); }
+		return id;
+	}
+	symbol_id intern(const std::string &s) { return intern(s.data(), s.size()); }
+	symbol_id intern(const char *s) { return intern(s, strlen(s)); }
+
+	/// text - the NUL terminated spelling of id, valid for the interner's life
+	const char *text(symbol_id id) const { return texts[id]; }
+	size_t length(symbol_id id) const { return lengths[id]; }
+	std::string name(symbol_id id) const { return std::string(texts[id], lengths[id]); }
+	size_t size() const { return texts.size(); }
+
+	/// reset - forget every spelling and the counters, releasing the
+	/// text; the ids handed out so far become meaningless
+	void reset() {
+		for (size_t i = 0; i < blocks.size(); i++) { delete[] blocks[i]; }
+		blocks.clear();
+		texts.clear();
+		lengths.clear();
+		hashes.clear();
+		slots.assign(256, -1);
+		mask = 255;
+		free_ptr = NULL;
+		free_left = 0;
+		n_lookups = n_hits = n_bytes = 0;
+	}
+
+	// counters for --stats
+	size_t lookups() const { return n_lookups; }
+	size_t hits() const { return n_hits; }
+	size_t bytes() const { return n_bytes; }
+};
+
+/// scoped_symbol_table - block-structured symbol table keyed by symbol_id.
+/// Every definition is pushed onto a binding stack and chained to the
+/// binding it shadows, and head[id] points at the innermost live binding,
+/// so lookup is a single index regardless of nesting depth.  Opening a
+/// scope records the stack height; closing it unwinds only the bindings
+/// made inside that scope.  Nothing is ever copied.
+template <class V>
+class scoped_symbol_table {
+	struct binding {
+		symbol_id sym;
+		int scope;
+		int prev;	// binding shadowed by this one, -1 if none
+		bool live;
+		V value;
+	};
+	std::vector<int> head;
+	std::vector<binding> bindings;
+	std::vector<int> marks;
+public:
+	int depth() const { return marks.size(); }
+	void push_scope() { marks.push_back(bindings.size()); }
+	void pop_scope() {
+		int mark = marks.back();
+		for (int b = (int)bindings.size() - 1; b >= mark; b--) {
+			if (bindings[b].live) { head[bindings[b].sym] = bindings[b].prev; }
+		}
+		bindings.resize(mark);
+		marks.pop_back();
+	}
+	/// insert - define sym in the innermost scope, replacing an existing
+	/// definition of sym in that same scope
+	void insert(symbol_id sym, V value) {
+		if (sym >= (symbol_id)head.size()) { head.resize(sym + 1, -1); }
+		int b = head[sym];
+		if (b >= 0 && bindings[b].scope == depth()) {
+			bindings[b].value = value;
+			return;
+		}
+		binding nb = { sym, depth(), b, true, value };
+		head[sym] = bindings.size();
+		bindings.push_back(nb);
+	}
+	/// erase - remove the innermost-scope definition of sym, if any
+	void erase(symbol_id sym) {
+		if (sym >= (symbol_id)head.size()) { return; }
+		int b = head[sym];
+		if (b >= 0 && bindings[b].scope == depth()) {
+			head[sym] = bindings[b].prev;
+			bindings[b].live = false;
+		}
+	}
+	V lookup(symbol_id sym) const {
+		if (sym >= (symbol_id)head.size() || head[sym] < 0) { return V(); }
+		return bindings[head[sym]].value;
+	}
+};
+
+#endif
@@ -0,0 +1,254 @@
+
+#ifndef _DECAF_TIER
+#define _DECAF_TIER
+
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "llvm/Analysis/CFG.h"
+#include "llvm/Bitcode/BitcodeReader.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/ExecutionEngine/Orc/IndirectionUtils.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/ThreadPool.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+#include "jit.h"
+#include "optimize.h"
+
+/// tier_options - when the tiered JIT recompiles a method and how loudly
+struct tier_options {
+	unsigned calls;		// calls to a method before it is recompiled
+	unsigned loops;		// loop iterations inside a method before it is recompiled
+	int level;		// -O level of the optimizing tier
+	bool log;		// report each transition on stderr
+	tier_options() : calls(1000), loops(100000), level(2), log(false) {}
+};
+
+/// tiered_jit - runs a program with two tiers of code for each method.
+/// Tier 0 is the module as generated, compiled by the JIT with fast
+/// instruction selection and a call counter and a loop counter added to
+/// every method but main.  Calls between methods go through ORC indirect
+/// stubs.  When a counter reaches its threshold the method is queued for a
+/// worker thread.  The worker rebuilds the method from a clean copy of the
+/// module at options.level, with the other methods available for
+/// inlining, and repoints its stub.  Calls already running finish in
+/// tier 0 code; the next call lands in the optimized code.
+class tiered_jit {
+	tier_options options;
+	std::unique_ptr<llvm::orc::LLJIT> jit;
+	std::unique_ptr<llvm::orc::IndirectStubsManager> stubs;
+	llvm::SmallVector<char, 0> bitcode;	// the module before instrumentation
+	std::vector<std::string> names;		// method names, indexed by method id
+	std::vector<bool> queued;
+	std::mutex lock;			// guards queued and the log
+	std::chrono::steady_clock::time_point started;
+	unsigned recompiled;
+	llvm::ThreadPool worker;
+
+	// called from tier 0 code when counter why (0 calls, 1 loops) of
+	// method id reaches its threshold
+	static void tier_up(tiered_jit *self, int id, int why) {
+		{
+			std::lock_guard<std::mutex> guard(self->lock);
+			if (self->queued[id]) { return; }
+			self->queued[id] = true;
+		}
+		self->worker.async([self, id, why]() { self->recompile(id, why); });
+	}
+
+	void report(const std::string &line) {
+		if (!options.log) { return; }
+		std::lock_guard<std::mutex> guard(lock);
+		double at = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - started).count();
+		llvm::errs() << "tier: " << llvm::format("%9.3f", at) << "ms " << line << "\n";
+	}
+
+	/// count - add one to counter before at and call tier_up the moment it
+	/// reaches threshold
+	void count(llvm::Instruction *at, llvm::GlobalVariable *counter, unsigned threshold, llvm::Function *callback, int id, int why) {
+		llvm::IRBuilder<> b(at);
+		llvm::Value *n = b.CreateAdd(b.CreateLoad(b.getInt32Ty(), counter), b.getInt32(1));
+		b.CreateStore(n, counter);
+		llvm::Instruction *then = llvm::SplitBlockAndInsertIfThen(b.CreateICmpEQ(n, b.getInt32(threshold)), at, false);
+		b.SetInsertPoint(then);
+		llvm::Value *self = b.CreateIntToPtr(b.getInt64((uint64_t)this), b.getInt8PtrTy());
+		b.CreateCall(callback, { self, b.getInt32(id), b.getInt32(why) });
+	}
+
+	/// instrument - turn each method F but main into a tier 0 body F$0 with
+	/// counters, and point every call to F at the stub named F
+	void instrument(llvm::Module &module) {
+		llvm::LLVMContext &context = module.getContext();
+		llvm::Type *i32 = llvm::Type::getInt32Ty(context);
+		llvm::FunctionType *callback_type = llvm::FunctionType::get(llvm::Type::getVoidTy(context),
+			{ llvm::Type::getInt8PtrTy(context), i32, i32 }, false);
+		llvm::Function *callback = llvm::Function::Create(callback_type, llvm::Function::ExternalLinkage, "decaf_tier_up", module);
+
+		std::vector<llvm::Function *> methods;
+		for (llvm::Function &func : module) {
+			if (!func.isDeclaration() && func.getName() != "main") { methods.push_back(&func); }
+		}
+		for (llvm::Function *func : methods) {
+			int id = names.size();
+			names.push_back(func->getName().str());
+			func->setName(names.back() + "$0");
+			llvm::Function *stub = llvm::Function::Create(func->getFunctionType(), llvm::Function::ExternalLinkage, names.back(), module);
+			func->replaceAllUsesWith(stub);
+
+			llvm::SmallVector<std::pair<const llvm::BasicBlock *, const llvm::BasicBlock *>, 8> backedges;
+			llvm::FindFunctionBackedges(*func, backedges);
+			std::vector<llvm::BasicBlock *> headers;
+			for (auto &edge : backedges) {
+				llvm::BasicBlock *header = const_cast<llvm::BasicBlock *>(edge.second);
+				if (std::find(headers.begin(), headers.end(), header) == headers.end()) { headers.push_back(header); }
+			}
+
+			llvm::GlobalVariable *calls = new llvm::GlobalVariable(module, i32, false, llvm::GlobalValue::InternalLinkage,
+				llvm::ConstantInt::get(i32, 0), names.back() + "$calls");
+			llvm::BasicBlock::iterator entry = func->getEntryBlock().begin();
+			while (llvm::isa<llvm::AllocaInst>(entry)) { ++entry; }
+			count(&*entry, calls, options.calls, callback, id, 0);
+			if (!headers.empty()) {
+				llvm::GlobalVariable *loops = new llvm::GlobalVariable(module, i32, false, llvm::GlobalValue::InternalLinkage,
+					llvm::ConstantInt::get(i32, 0), names.back() + "$loops");
+				for (llvm::BasicBlock *header : headers) {
+					count(&*header->getFirstInsertionPt(), loops, options.loops, callback, id, 1);
+				}
+			}
+		}
+		queued.assign(names.size(), false);
+	}
+
+	/// recompile - build method id at options.level from the clean copy of
+	/// the module and repoint its stub.  Runs on the worker thread with a
+	/// context of its own, so it never touches the running program's IR.
+	void recompile(int id, int why) {
+		auto start = std::chrono::steady_clock::now();
+		const std::string &name = names[id];
+		std::string body = name + "$" + std::to_string(options.level);
+		std::string error;
+
+		std::unique_ptr<llvm::LLVMContext> context(new llvm::LLVMContext);
+		auto parsed = llvm::parseBitcodeFile(llvm::MemoryBufferRef(llvm::StringRef(bitcode.data(), bitcode.size()), "tier0"), *context);
+		if (!parsed) {
+			report(name + ": " + llvm::toString(parsed.takeError()));
+			return;
+		}
+		std::unique_ptr<llvm::Module> module = std::move(*parsed);
+		for (llvm::Function &func : *module) {
+			if (func.isDeclaration()) { continue; }
+			if (func.getName() == name) {
+				func.setName(body);
+			} else {
+				// may be inlined here; otherwise calls go through its stub
+				func.setLinkage(llvm::GlobalValue::AvailableExternallyLinkage);
+			}
+		}
+		// variables live in tier 0; only constants are copied
+		for (llvm::GlobalVariable &var : module->globals()) {
+			if (!var.isConstant() && !var.isDeclaration()) {
+				var.setInitializer(NULL);
+				var.setLinkage(llvm::GlobalValue::ExternalLinkage);
+			}
+		}
+		if (!decaf_optimize(*module, options.level, "", error)) {
+			report(name + ": " + error);
+			return;
+		}
+		if (llvm::Error err = jit->addIRModule(llvm::orc::ThreadSafeModule(std::move(module), std::move(context)))) {
+			report(name + ": " + llvm::toString(std::move(err)));
+			return;
+		}
+		auto code = jit->lookup(body);
+		if (!code) {
+			report(name + ": " + llvm::toString(code.takeError()));
+			return;
+		}
+		if (llvm::Error err = stubs->updatePointer(name, code->getAddress())) {
+			report(name + ": " + llvm::toString(std::move(err)));
+			return;
+		}
+		double took = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			recompiled++;
+		}
+		std::string line;
+		llvm::raw_string_ostream out(line);
+		out << name << " -> O" << options.level << " after ";
+		if (why == 0) { out << options.calls << " calls"; } else { out << options.loops << " loop iterations"; }
+		out << ", compiled in " << llvm::format("%.3f", took) << "ms";
+		report(out.str());
+	}
+
+public:
+	tiered_jit(const tier_options &options)
+		: options(options), recompiled(0), worker(llvm::hardware_concurrency(1)) {}
+	~tiered_jit() { worker.wait(); }
+
+	/// run - as decaf_run, but tiered
+	bool run(std::unique_ptr<llvm::Module> module, std::unique_ptr<llvm::LLVMContext> context, int &status, std::string &error) {
+		started = std::chrono::steady_clock::now();
+		bool returns_int;
+		if (!main_returns_int(*module, returns_int, error)) { return false; }
+
+		// variables are shared by both tiers, so they need names the
+		// optimized modules can link against
+		for (llvm::GlobalVariable &var : module->globals()) {
+			if (!var.isConstant() && var.hasLocalLinkage()) { var.setLinkage(llvm::GlobalValue::ExternalLinkage); }
+		}
+		llvm::raw_svector_ostream out(bitcode);
+		llvm::WriteBitcodeToFile(*module, out);
+		instrument(*module);
+
+		auto host = host_jit_builder(llvm::CodeGenOpt::None);
+		if (!host) { return jit_failed(host.takeError(), error); }
+		llvm::Triple triple = host->getTargetTriple();
+		auto built = llvm::orc::LLJITBuilder().setJITTargetMachineBuilder(std::move(*host)).create();
+		if (!built) { return jit_failed(built.takeError(), error); }
+		jit = std::move(*built);
+		if (!bind_stdlib(*jit, error)) { return false; }
+		stubs = llvm::orc::createLocalIndirectStubsManagerBuilder(triple)();
+		if (!stubs) {
+			error = "no indirect stubs for " + triple.str();
+			return false;
+		}
+
+		// stubs first, aimed at tier 0 once it has addresses
+		llvm::JITSymbolFlags flags = llvm::JITSymbolFlags::Exported | llvm::JITSymbolFlags::Callable;
+		llvm::orc::IndirectStubsManager::StubInitsMap inits;
+		for (const std::string &name : names) { inits[name] = std::make_pair(0, flags); }
+		if (llvm::Error err = stubs->createStubs(inits)) { return jit_failed(std::move(err), error); }
+		llvm::orc::SymbolMap entries;
+		for (const std::string &name : names) { entries[jit->mangleAndIntern(name)] = stubs->findStub(name, true); }
+		entries[jit->mangleAndIntern("decaf_tier_up")] = llvm::JITEvaluatedSymbol(llvm::pointerToJITTargetAddress(&tier_up), flags);
+		if (llvm::Error err = jit->getMainJITDylib().define(llvm::orc::absoluteSymbols(std::move(entries)))) {
+			return jit_failed(std::move(err), error);
+		}
+		if (llvm::Error err = jit->addIRModule(llvm::orc::ThreadSafeModule(std::move(module), std::move(context)))) {
+			return jit_failed(std::move(err), error);
+		}
+		for (const std::string &name : names) {
+			auto code = jit->lookup(name + "$0");
+			if (!code) { return jit_failed(code.takeError(), error); }
+			if (llvm::Error err = stubs->updatePointer(name, code->getAddress())) { return jit_failed(std::move(err), error); }
+		}
+		report("tier 0 ready, " + std::to_string(names.size()) + " methods");
+
+		bool ok = run_main(*jit, returns_int, status, error);
+		worker.wait();
+		report("exit, " + std::to_string(recompiled) + " of " + std::to_string(names.size()) + " methods recompiled");
+		return ok;
+	}
+};
+
+/// decaf_run_tiered - execute module with a tiered_jit
+inline bool decaf_run_tiered(std::unique_ptr<llvm::Module> module, std::unique_ptr<llvm::LLVMContext> context,
+                             const tier_options &options, int &status, std::string &error) {
+	tiered_jit tiers(options);
+	return tiers.run(std::move(module), std::move(context), status, error);
+}
+
+#endif
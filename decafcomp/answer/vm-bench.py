@@ -0,0 +1,197 @@
+#!/usr/bin/env python3
+
+"""
+usage: %s [-c CODEGEN] [-n REPEAT] [-s SCALE] SOURCE-FILE...
+
+Compare running Decaf programs in the bytecode VM with the LLVM paths.
+
+startup   each SOURCE-FILE (with NAME.in as its input when there is one)
+          run from source to exit by CODEGEN --vm and CODEGEN --run.
+          The testcases finish in well under a millisecond once running,
+          so this is almost all start-up: loading, parsing, lowering or
+          code generation.
+steady    a generated loop and call heavy program (recursion, nested
+          loops, a global counter) whose work grows with SCALE
+          (default 1), run by --vm, --run, -O2 --run and, when CC can
+          link the object from CODEGEN -o, natively.  For native code
+          only the run is timed.
+
+Each measurement is the fastest of REPEAT runs (default 5).  Files that
+crash or run for over ten seconds, and files whose output differs between
+--vm and --run, are left out.
+
+Environment variable CC is used as in llvm-run.
+"""
+
+import getopt
+import os
+import os.path
+import shutil
+import subprocess
+import sys
+import tempfile
+import time
+
+cc = os.environ.get('CC') or 'clang'
+stdlib = os.path.join(os.path.dirname(os.path.abspath(__file__)), 'decaf-stdlib.c')
+
+steady_program = """
+extern func print_int(int) void;
+extern func print_string(string) void;
+
+package Steady {
+    var calls int;
+
+    func fib(n int) int {
+        if (n < 2) { return(n); }
+        return(fib(n - 1) + fib(n - 2));
+    }
+
+    func collatz(n int) int {
+        var steps int;
+        while (n != 1) {
+            if (n %% 2 == 0) { n = n / 2; } else { n = 3 * n + 1; }
+            steps = steps + 1;
+        }
+        return(steps);
+    }
+
+    func gcd(a int, b int) int {
+        calls = calls + 1;
+        while (b != 0) {
+            var t int;
+            t = b;
+            b = a %% b;
+            a = t;
+        }
+        return(a);
+    }
+
+    func main() int {
+        var i, j, total int;
+        for (i = 0; i < %(scale)d; i = i + 1) { total = total + fib(24); }
+        for (i = 1; i < %(scale)d * 100000; i = i + 1) { total = total + collatz(i %% 1000 + 1); }
+        for (i = 1; i < %(scale)d * 300; i = i + 1) {
+            for (j = 1; j < 300; j = j + 1) { total = total + gcd(i, j); }
+        }
+        print_int(total);
+        print_string(" ");
+        print_int(calls);
+        print_string("\\n");
+        return(0);
+    }
+}
+"""
+
+def run(argv, source, infile):
+    """wall time and output of argv, or None if it crashes or takes
+    longer than ten seconds"""
+    with open(infile) as stdin:
+        start = time.perf_counter()
+        try:
+            proc = subprocess.run(argv + ([source] if source else []), stdin=stdin, timeout=10,
+                                  stdout=subprocess.PIPE, stderr=subprocess.DEVNULL)
+        except subprocess.TimeoutExpired:
+            return None
+        elapsed = time.perf_counter() - start
+    if proc.returncode < 0:
+        return None
+    # the two paths word semantic errors differently
+    if proc.stdout.startswith(b"semantic error"):
+        return elapsed, b"semantic error"
+    return elapsed, proc.stdout
+
+def best_of(repeat, argv, source, infile):
+    best = None
+    output = None
+    for _ in range(repeat):
+        result = run(argv, source, infile)
+        if result is None:
+            return None
+        best = result[0] if best is None else min(best, result[0])
+        output = result[1]
+    return best, output
+
+def input_for(source):
+    name = os.path.splitext(source)[0] + ".in"
+    return name if os.path.exists(name) else os.devnull
+
+def startup(codegen, repeat, sources):
+    totals = [0.0, 0.0]
+    count = 0
+    print("%-32s %10s %10s" % ("file", "vm(ms)", "run(ms)"))
+    for source in sources:
+        infile = input_for(source)
+        vm = best_of(repeat, [codegen, "--vm"], source, infile)
+        jit = best_of(repeat, [codegen, "--run"], source, infile) if vm else None
+        if jit is None:
+            continue
+        if vm[1] != jit[1]:
+            print("%-32s output differs, skipped" % os.path.basename(source)[:32])
+            continue
+        count += 1
+        totals[0] += vm[0]
+        totals[1] += jit[0]
+        print("%-32s %10.2f %10.2f" % (os.path.basename(source)[:32], vm[0] * 1000, jit[0] * 1000))
+    if count == 0:
+        print("no file ran", file=sys.stderr)
+        sys.exit(1)
+    print("%-32s %10.2f %10.2f" % ("total (%d files)" % count, totals[0] * 1000, totals[1] * 1000))
+    print("start-up: vm %.2fms, run %.2fms per program (%.1fx)"
+          % (totals[0] * 1000 / count, totals[1] * 1000 / count, totals[1] / totals[0]))
+
+def steady(codegen, repeat, scale, tmp):
+    source = os.path.join(tmp, "steady.decaf")
+    with open(source, 'w') as out:
+        out.write(steady_program % {'scale': scale})
+    rows = [("vm", [codegen, "--vm"], source),
+            ("run", [codegen, "--run"], source),
+            ("run -O2", [codegen, "-O2", "--run"], source)]
+    obj = os.path.join(tmp, "steady.o")
+    exe = os.path.join(tmp, "steady")
+    with open(os.devnull, 'w') as devnull:
+        if (subprocess.call([codegen, "-O2", "-o", obj, source], stdout=devnull, stderr=devnull) == 0 and
+                subprocess.call([cc, obj, stdlib, "-o", exe], stdout=devnull, stderr=devnull) == 0):
+            rows.append(("native -O2", [exe], None))
+
+    print("\n%-12s %10s   (scale %d)" % ("steady", "time(ms)", scale))
+    expected = None
+    base = None
+    for name, argv, src in rows:
+        result = best_of(repeat, argv, src, os.devnull)
+        if result is None:
+            print("%-12s %10s" % (name, "failed"))
+            continue
+        if expected is None:
+            expected, base = result[1], result[0]
+        note = "" if result[1] == expected else "  output differs"
+        print("%-12s %10.1f %9.1fx%s" % (name, result[0] * 1000, base / result[0], note))
+
+def main():
+    codegen = os.path.join('.', 'decafcomp')
+    repeat = 5
+    scale = 1
+    try:
+        opts, args = getopt.getopt(sys.argv[1:], "c:n:s:")
+        for opt, value in opts:
+            if opt == "-c":
+                codegen = value
+            elif opt == "-n":
+                repeat = int(value)
+            elif opt == "-s":
+                scale = int(value)
+        if not args:
+            raise getopt.GetoptError("no source files")
+    except (getopt.GetoptError, ValueError):
+        print(__doc__ % (sys.argv[0]), file=sys.stderr)
+        sys.exit(2)
+
+    tmp = tempfile.mkdtemp(prefix="vm-bench.")
+    try:
+        startup(codegen, repeat, args)
+        steady(codegen, repeat, scale, tmp)
+    finally:
+        shutil.rmtree(tmp)
+
+if __name__ == '__main__':
+    main()
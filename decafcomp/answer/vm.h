@@ -0,0 +1,276 @@
+
+#ifndef _DECAF_VM
+#define _DECAF_VM
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "decaf-stdlib.h"
+
+/// decafVmOp - the bytecode's operations.  a, b and c are register
+/// numbers in the current frame unless noted otherwise.
+enum decafVmOp {
+	VmConst,	// a = b (immediate)
+	VmMove,		// a = b
+	VmAdd, VmSub, VmMul, VmDiv, VmMod, VmShl, VmShr,	// a = b op c
+	VmAddImm,	// a = b + c (immediate)
+	VmEq, VmNe, VmLt, VmLe, VmGt, VmGe,			// a = b cmp c
+	VmNeg,		// a = -b
+	VmNot,		// a = !b
+	VmJump,		// go to instruction a
+	VmJumpIfZero,	// go to instruction b if a is 0
+	VmJumpIfNotZero,	// go to instruction b unless a is 0
+	VmJumpIfEq, VmJumpIfNe, VmJumpIfLt, VmJumpIfLe, VmJumpIfGt, VmJumpIfGe,	// go to instruction c if a cmp b
+	VmLoadGlobal,	// a = global b
+	VmStoreGlobal,	// global a = b
+	VmLoadArray,	// a = array b at index c
+	VmStoreArray,	// array a at index b = c
+	VmCall,		// a = method b, called with its arguments in c, c+1, ...
+	VmPrintInt,	// print_int(a)
+	VmPrintString,	// print_string(string a)
+	VmReadInt,	// a = read_int()
+	VmReturn,	// return a
+	VmReturnVoid,
+	VmNumOps
+};
+
+/// vm_defines - whether op computes a value into register a
+inline bool vm_defines(int32_t op) {
+	return op <= VmNot || op == VmLoadGlobal || op == VmLoadArray || op == VmCall || op == VmReadInt;
+}
+
+/// vm_insn - one instruction, fixed width
+struct vm_insn {
+	int32_t op;
+	int32_t a, b, c;
+};
+
+/// vm_method - where a method's code starts and the size of its frame.
+/// The first nparams registers hold the arguments.
+struct vm_method {
+	std::string name;
+	int entry;
+	int nparams;
+	int nregs;
+	bool returns;	// main's value is the exit status only if it returns one
+};
+
+/// vm_array - a global array: size elements of the array store from base
+struct vm_array {
+	int base;
+	int size;
+};
+
+/// vm_program - a whole program in bytecode.  All methods share one code
+/// vector, so jump targets and entries are plain instruction indexes.
+struct vm_program {
+	std::vector<vm_insn> code;
+	std::vector<vm_method> methods;
+	std::vector<int32_t> globals;		// initial values of the scalar globals
+	std::vector<vm_array> arrays;
+	int array_words;			// elements in all arrays together
+	std::vector<std::string> strings;	// string constants, by index
+	int main;				// method to run, -1 if there is none
+
+	vm_program() : array_words(0), main(-1) {}
+	int emit(int32_t op, int32_t a = 0, int32_t b = 0, int32_t c = 0) {
+		vm_insn insn = { op, a, b, c };
+		code.push_back(insn);
+		return code.size() - 1;
+	}
+};
+
+// registers for all frames together; a frame is nregs of them
+static const size_t VM_STACK_WORDS = 1 << 22;
+
+/// vm_run - execute program from its main and set status to what main
+/// returns (0 for a void main).  Frames are windows onto one flat register
+/// stack: a caller puts the arguments in consecutive registers at the top
+/// of its frame and the callee's frame starts there, so a call copies
+/// nothing.  With GCC or Clang each instruction's opcode is replaced by
+/// the address of its handler before running and every handler jumps
+/// straight to the next one (computed goto); other compilers use a switch.
+/// Returns false and sets error on a runtime error (the program's output
+/// up to that point has been written).
+inline bool vm_run(const vm_program &program, int &status, std::string &error) {
+	struct vm_frame {
+		const void *pc;
+		int32_t *regs;
+		int32_t dst;
+	};
+	if (program.main < 0) {
+		error = "no main method to run";
+		return false;
+	}
+
+	// left uninitialized: the OS only maps the pages a program reaches,
+	// and locals are zeroed by the code that declares them
+	std::unique_ptr<int32_t[]> stack(new int32_t[VM_STACK_WORDS]);
+	std::vector<vm_frame> frames;
+	frames.reserve(1024);
+	std::vector<int32_t> globals(program.globals);
+	std::vector<int32_t> arrays(program.array_words, 0);
+	const vm_method *methods = program.methods.data();
+	const vm_array *array_info = program.arrays.data();
+	int32_t *stack_end = stack.get() + VM_STACK_WORDS;
+	int32_t *regs = stack.get();
+	int32_t result = 0;
+
+#ifdef __GNUC__
+	struct vm_threaded {
+		const void *handler;
+		int32_t a, b, c;
+	};
+	static const void *const handlers[VmNumOps] = {
+		&&do_VmConst, &&do_VmMove,
+		&&do_VmAdd, &&do_VmSub, &&do_VmMul, &&do_VmDiv, &&do_VmMod, &&do_VmShl, &&do_VmShr, &&do_VmAddImm,
+		&&do_VmEq, &&do_VmNe, &&do_VmLt, &&do_VmLe, &&do_VmGt, &&do_VmGe,
+		&&do_VmNeg, &&do_VmNot,
+		&&do_VmJump, &&do_VmJumpIfZero, &&do_VmJumpIfNotZero,
+		&&do_VmJumpIfEq, &&do_VmJumpIfNe, &&do_VmJumpIfLt, &&do_VmJumpIfLe, &&do_VmJumpIfGt, &&do_VmJumpIfGe,
+		&&do_VmLoadGlobal, &&do_VmStoreGlobal, &&do_VmLoadArray, &&do_VmStoreArray,
+		&&do_VmCall, &&do_VmPrintInt, &&do_VmPrintString, &&do_VmReadInt,
+		&&do_VmReturn, &&do_VmReturnVoid
+	};
+	std::vector<vm_threaded> code(program.code.size());
+	for (size_t i = 0; i < code.size(); i++) {
+		const vm_insn &insn = program.code[i];
+		vm_threaded t = { handlers[insn.op], insn.a, insn.b, insn.c };
+		code[i] = t;
+	}
+	const vm_threaded *start = code.data();
+	const vm_threaded *pc = start + methods[program.main].entry;
+#define VM_OP(name) do_##name:
+#define VM_NEXT() goto *pc->handler
+#define VM_FETCH() const vm_threaded &i = *pc++
+#else
+	const vm_insn *start = program.code.data();
+	const vm_insn *pc = start + methods[program.main].entry;
+#define VM_OP(name) case name:
+#define VM_NEXT() goto dispatch
+#define VM_FETCH() const vm_insn &i = *pc++
+#endif
+#define VM_BINARY(name, expr) VM_OP(name) { VM_FETCH(); uint32_t x = regs[i.b], y = regs[i.c]; (void)x; (void)y; regs[i.a] = (expr); } VM_NEXT();
+#define VM_BRANCH(name, cmp) VM_OP(name) { VM_FETCH(); if (regs[i.a] cmp regs[i.b]) { pc = start + i.c; } } VM_NEXT();
+
+	if (regs + methods[program.main].nregs > stack_end) { goto overflow; }
+#ifdef __GNUC__
+	VM_NEXT();
+#else
+dispatch:
+	switch (pc->op) {
+#endif
+	VM_OP(VmConst) { VM_FETCH(); regs[i.a] = i.b; } VM_NEXT();
+	VM_OP(VmMove) { VM_FETCH(); regs[i.a] = regs[i.b]; } VM_NEXT();
+	// arithmetic wraps like the generated code; shifts use the low 5 bits
+	VM_BINARY(VmAdd, (int32_t)(x + y))
+	VM_BINARY(VmSub, (int32_t)(x - y))
+	VM_BINARY(VmMul, (int32_t)(x * y))
+	VM_BINARY(VmShl, (int32_t)(x << (y & 31)))
+	VM_BINARY(VmShr, (int32_t)(x >> (y & 31)))
+	VM_OP(VmAddImm) { VM_FETCH(); regs[i.a] = (int32_t)((uint32_t)regs[i.b] + (uint32_t)i.c); } VM_NEXT();
+	VM_BINARY(VmEq, regs[i.b] == regs[i.c])
+	VM_BINARY(VmNe, regs[i.b] != regs[i.c])
+	VM_BINARY(VmLt, regs[i.b] < regs[i.c])
+	VM_BINARY(VmLe, regs[i.b] <= regs[i.c])
+	VM_BINARY(VmGt, regs[i.b] > regs[i.c])
+	VM_BINARY(VmGe, regs[i.b] >= regs[i.c])
+	VM_OP(VmDiv) {
+		VM_FETCH();
+		int32_t x = regs[i.b], y = regs[i.c];
+		if (y == 0) { goto divide_by_zero; }
+		regs[i.a] = y == -1 ? (int32_t)(0u - (uint32_t)x) : x / y;
+	} VM_NEXT();
+	VM_OP(VmMod) {
+		VM_FETCH();
+		int32_t x = regs[i.b], y = regs[i.c];
+		if (y == 0) { goto divide_by_zero; }
+		regs[i.a] = y == -1 ? 0 : x % y;
+	} VM_NEXT();
+	VM_OP(VmNeg) { VM_FETCH(); regs[i.a] = (int32_t)(0u - (uint32_t)regs[i.b]); } VM_NEXT();
+	VM_OP(VmNot) { VM_FETCH(); regs[i.a] = !regs[i.b]; } VM_NEXT();
+	VM_OP(VmJump) { pc = start + pc->a; } VM_NEXT();
+	VM_OP(VmJumpIfZero) { VM_FETCH(); if (regs[i.a] == 0) { pc = start + i.b; } } VM_NEXT();
+	VM_OP(VmJumpIfNotZero) { VM_FETCH(); if (regs[i.a] != 0) { pc = start + i.b; } } VM_NEXT();
+	VM_BRANCH(VmJumpIfEq, ==)
+	VM_BRANCH(VmJumpIfNe, !=)
+	VM_BRANCH(VmJumpIfLt, <)
+	VM_BRANCH(VmJumpIfLe, <=)
+	VM_BRANCH(VmJumpIfGt, >)
+	VM_BRANCH(VmJumpIfGe, >=)
+	VM_OP(VmLoadGlobal) { VM_FETCH(); regs[i.a] = globals[i.b]; } VM_NEXT();
+	VM_OP(VmStoreGlobal) { VM_FETCH(); globals[i.a] = regs[i.b]; } VM_NEXT();
+	VM_OP(VmLoadArray) {
+		VM_FETCH();
+		const vm_array &array = array_info[i.b];
+		uint32_t index = regs[i.c];
+		if (index >= (uint32_t)array.size) { goto out_of_bounds; }
+		regs[i.a] = arrays[array.base + index];
+	} VM_NEXT();
+	VM_OP(VmStoreArray) {
+		VM_FETCH();
+		const vm_array &array = array_info[i.a];
+		uint32_t index = regs[i.b];
+		if (index >= (uint32_t)array.size) { goto out_of_bounds; }
+		arrays[array.base + index] = regs[i.c];
+	} VM_NEXT();
+	VM_OP(VmCall) {
+		VM_FETCH();
+		const vm_method &callee = methods[i.b];
+		int32_t *callee_regs = regs + i.c;
+		if (callee_regs + callee.nregs > stack_end) { goto overflow; }
+		vm_frame frame = { pc, regs, i.a };
+		frames.push_back(frame);
+		regs = callee_regs;
+		pc = start + callee.entry;
+	} VM_NEXT();
+	VM_OP(VmPrintInt) { VM_FETCH(); print_int(regs[i.a]); } VM_NEXT();
+	VM_OP(VmPrintString) { VM_FETCH(); print_string(program.strings[regs[i.a]].c_str()); } VM_NEXT();
+	VM_OP(VmReadInt) { VM_FETCH(); regs[i.a] = read_int(); } VM_NEXT();
+	VM_OP(VmReturn) {
+		int32_t value = regs[pc->a];
+		if (frames.empty()) {
+			result = value;
+			goto done;
+		}
+		vm_frame &frame = frames.back();
+		regs = frame.regs;
+		regs[frame.dst] = value;
+		pc = (decltype(pc))frame.pc;
+		frames.pop_back();
+	} VM_NEXT();
+	VM_OP(VmReturnVoid) {
+		if (frames.empty()) { goto done; }
+		vm_frame &frame = frames.back();
+		regs = frame.regs;
+		pc = (decltype(pc))frame.pc;
+		frames.pop_back();
+	} VM_NEXT();
+#ifndef __GNUC__
+	}
+#endif
+#undef VM_BRANCH
+#undef VM_BINARY
+#undef VM_FETCH
+#undef VM_NEXT
+#undef VM_OP
+
+done:
+	decaf_flush();
+	status = methods[program.main].returns ? result : 0;
+	return true;
+divide_by_zero:
+	error = "division by zero";
+	goto failed;
+out_of_bounds:
+	error = "array index out of bounds";
+	goto failed;
+overflow:
+	error = "stack overflow";
+failed:
+	decaf_flush();
+	return false;
+}
+
+#endif